@@ -1,4 +1,6 @@
 #pragma once
+#include <cstdint>
+#include <cstring>
 #include "math/vec2.h"
 #include "math/vec3.h"
 #include "math/util.h"
@@ -40,16 +42,29 @@ public:
         time1 = t1;
     }
 
-    Ray CastRay(XFloat s, XFloat t) const {
-        Vec2f rd = lens_radius * math::random::PointInsideUnitCircle();
+    Ray CastRay(XFloat s, XFloat t, math::Rand& rng) const {
+        Vec2f rd = lens_radius * math::random::PointInsideUnitCircle(rng);
         Vec3f offset = u * rd.x + v * rd.y;
         return Ray(
             origin + offset,
             (lower_left_corner + s*horizontal + t*vertical - origin - offset).Normalize(),
-            math::random::Random<XFloat>(time0, time1)
+            math::random::Random<XFloat>(rng, time0, time1)
         );
     }
 
+    // Identifies the view in checkpoints, every ray the camera casts depends on these
+    uint64_t Hash() const {
+        const XFloat values[] = { origin.x, origin.y, origin.z, lower_left_corner.x, lower_left_corner.y, lower_left_corner.z,
+            horizontal.x, horizontal.y, horizontal.z, vertical.x, vertical.y, vertical.z, lens_radius, time0, time1 };
+        uint64_t hash = 0;
+        for (XFloat value : values) {
+            uint64_t bits = 0;
+            std::memcpy(&bits, &value, sizeof(value));
+            hash = math::MixBits(hash ^ bits);
+        }
+        return hash;
+    }
+
 private:
     Vec3f origin;
     Vec3f lower_left_corner;
@@ -8,22 +8,23 @@ struct AABB {
     AABB() : min(Vec3f::zero), max(Vec3f::zero) {}
     AABB(const Vec3f& a, const Vec3f& b) : min(a), max(b) {}
 
+    // Slab test on the cached inverse direction, the near and far planes are
+    // selected by the direction signs instead of swapped. A NaN slab (origin on
+    // a plane of a flat box) leaves the running interval unchanged.
     bool Hit(const Ray& r, XFloat t_min, XFloat t_max, XFloat* t=nullptr) const {
         XFloat t_enter = -math::kInfinite;
         XFloat t_exit = math::kInfinite;
 
         for (int i = 0; i < 3; i++) {
-            auto invD = 1.0f / r.direction[i];
-            auto t0 = (min[i] - r.origin[i]) * invD;
-            auto t1 = (max[i] - r.origin[i]) * invD;
-            if (invD < 0.0)
-                std::swap(t0, t1);
-            if (t0 > t_enter) t_enter = t0;
-            if (t1 < t_exit) t_exit = t1;
-            if (t_exit <= t_enter || t_enter > t_max || t_exit < t_min)
-                return false;
+            auto t0 = ((r.dir_is_neg[i] ? max[i] : min[i]) - r.origin[i]) * r.inv_direction[i];
+            auto t1 = ((r.dir_is_neg[i] ? min[i] : max[i]) - r.origin[i]) * r.inv_direction[i];
+            t_enter = std::max(t_enter, t0);
+            t_exit = std::min(t_exit, t1);
         }
 
+        if (t_exit <= t_enter || t_enter > t_max || t_exit < t_min)
+            return false;
+
         if (t) {
             if (t_enter >= t_min && t_enter <= t_max)
                 *t = t_enter;
@@ -2,14 +2,18 @@
 
 #include "math/vec3.h"
 
+// The inverse direction and its signs are cached at construction for slab tests,
+// so a ray is immutable once built.
 struct Ray {
-    Ray() {}
+    Ray() : time(0), dir_is_neg{0, 0, 0} {}
     Ray(const Vec3f& origin_, const Vec3f& direction_)
-        : origin(origin_), direction(direction_), time(0)
+        : Ray(origin_, direction_, 0)
     {}
 
     Ray(const Vec3f& origin_, const Vec3f& direction_, XFloat time_)
-        : origin(origin_), direction(direction_), time(time_)
+        : origin(origin_), direction(direction_), time(time_),
+          inv_direction(1.0 / direction_.x, 1.0 / direction_.y, 1.0 / direction_.z),
+          dir_is_neg{inv_direction.x < 0, inv_direction.y < 0, inv_direction.z < 0}
     {}
 
     Vec3f at(XFloat t) const {
@@ -19,4 +23,6 @@ struct Ray {
     Vec3f origin;
     Vec3f direction;
     XFloat time;
+    Vec3f inv_direction;
+    int dir_is_neg[3];
 };
@@ -17,11 +17,17 @@ struct Vertex {
     Vec2f texcoord;
 
     static void CalcTangent(const Vertex & v0, const Vertex & v1, const Vertex & v2, Vec3f& tangent, Vec3f& bitangent) {
-        Vec4f q1 = v1.position - v0.position;
-        Vec4f q2 = v2.position - v0.position;
+        CalcTangent(v0.position, v1.position, v2.position, v0.texcoord, v1.texcoord, v2.texcoord, tangent, bitangent);
+    }
+
+    static void CalcTangent(const Vec3f& p0, const Vec3f& p1, const Vec3f& p2,
+        const Vec2f& uv0, const Vec2f& uv1, const Vec2f& uv2, Vec3f& tangent, Vec3f& bitangent)
+    {
+        Vec4f q1 = p1 - p0;
+        Vec4f q2 = p2 - p0;
 
-        Vec2f duv1 = v1.texcoord - v0.texcoord;
-        Vec2f duv2 = v2.texcoord - v0.texcoord;
+        Vec2f duv1 = uv1 - uv0;
+        Vec2f duv2 = uv2 - uv0;
         XFloat du1 = duv1.u;
         XFloat dv1 = duv1.v;
         XFloat du2 = duv2.u;
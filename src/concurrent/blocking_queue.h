@@ -1,6 +1,7 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
 #include <list>
 #include <condition_variable>
 #include <mutex>
@@ -35,7 +36,8 @@ private:
 };
 
 template<typename T>
-BlockingQueue<T>::BlockingQueue(int capacity) : stop_(false) {
+BlockingQueue<T>::BlockingQueue(int capacity) : capacity_(0), stop_(false) {
+    // A negative capacity means unbounded
     if (capacity >= 0) {
         capacity_ = math::Max(capacity, 128);
     }
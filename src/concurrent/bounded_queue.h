@@ -0,0 +1,214 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+#include "common/uncopyable.h"
+
+// Fixed capacity MPMC ring buffer (Dmitry Vyukov's bounded queue). Every cell carries a
+// sequence number telling producers and consumers whose turn it is, so pushes and pops
+// are one CAS on their own counter and never allocate. Same surface as BlockingQueue;
+// the mutex is only touched to park and wake consumers in WaitPop.
+template<typename T>
+class BoundedQueue: private Uncopyable {
+public:
+    // capacity is rounded up to a power of two
+    BoundedQueue(size_t capacity);
+    ~BoundedQueue();
+
+    size_t capacity() const { return mask_ + 1; }
+    // Approximate while other threads push or pop
+    size_t size() const;
+
+    bool TryPush(T&& v);
+    // Waits for a free cell, false if the queue was stopped first
+    bool Push(T&& v);
+
+    bool TryPop(T& v);
+    bool WaitPop(T& v, int32_t wait_us=-1);
+
+    void NotifyAll();
+    void NotifyOne();
+
+    void Stop();
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        alignas(T) unsigned char storage[sizeof(T)];
+
+        T* value() { return reinterpret_cast<T*>(storage); }
+    };
+
+    void WakeConsumer();
+
+    std::unique_ptr<Cell[]> cells_;
+    size_t mask_;
+
+    alignas(64) std::atomic<size_t> enqueue_pos_;
+    alignas(64) std::atomic<size_t> dequeue_pos_;
+    alignas(64) std::atomic<int> waiters_;
+    std::atomic<bool> stop_;
+
+    std::mutex mutex_;
+    std::condition_variable ready_;
+};
+
+template<typename T>
+BoundedQueue<T>::BoundedQueue(size_t capacity) : enqueue_pos_(0), dequeue_pos_(0), waiters_(0), stop_(false) {
+    size_t size = 2;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    cells_.reset(new Cell[size]);
+    mask_ = size - 1;
+    for (size_t i = 0; i < size; ++i) {
+        cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+template<typename T>
+BoundedQueue<T>::~BoundedQueue() {
+    size_t end = enqueue_pos_.load(std::memory_order_relaxed);
+    for (size_t pos = dequeue_pos_.load(std::memory_order_relaxed); pos != end; ++pos) {
+        cells_[pos & mask_].value()->~T();
+    }
+}
+
+template<typename T>
+size_t BoundedQueue<T>::size() const {
+    size_t enqueue = enqueue_pos_.load(std::memory_order_relaxed);
+    size_t dequeue = dequeue_pos_.load(std::memory_order_relaxed);
+    return enqueue > dequeue ? enqueue - dequeue : 0;
+}
+
+template<typename T>
+void BoundedQueue<T>::Stop() {
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        stop_.store(true);
+    }
+    ready_.notify_all();
+}
+
+template<typename T>
+void BoundedQueue<T>::NotifyAll() {
+    ready_.notify_all();
+}
+
+template<typename T>
+void BoundedQueue<T>::NotifyOne() {
+    ready_.notify_one();
+}
+
+template<typename T>
+bool BoundedQueue<T>::TryPush(T&& v) {
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+        cell = &cells_[pos & mask_];
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+        if (diff == 0) {
+            if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // The cell still holds the value of the previous lap
+            return false;
+        } else {
+            pos = enqueue_pos_.load(std::memory_order_relaxed);
+        }
+    }
+
+    new (cell->storage) T(std::move(v));
+    cell->sequence.store(pos + 1, std::memory_order_release);
+
+    WakeConsumer();
+    return true;
+}
+
+template<typename T>
+bool BoundedQueue<T>::Push(T&& v) {
+    while (!TryPush(std::move(v))) {
+        if (stop_.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        std::this_thread::yield();
+    }
+    return true;
+}
+
+template<typename T>
+bool BoundedQueue<T>::TryPop(T& v) {
+    size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+        cell = &cells_[pos & mask_];
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+        if (diff == 0) {
+            if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // Nothing was pushed to this cell yet
+            return false;
+        } else {
+            pos = dequeue_pos_.load(std::memory_order_relaxed);
+        }
+    }
+
+    T* value = cell->value();
+    v = std::move(*value);
+    value->~T();
+    // Hand the cell to the producer of the next lap
+    cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+}
+
+template<typename T>
+bool BoundedQueue<T>::WaitPop(T& v, int32_t wait_us) {
+    if (TryPop(v)) {
+        return true;
+    }
+    if (wait_us == 0) {
+        return false;
+    }
+
+    bool popped = false;
+    auto ready = [this, &v, &popped] {
+        popped = TryPop(v);
+        return popped || stop_.load();
+    };
+
+    std::unique_lock<std::mutex> lk(mutex_);
+    // Registered before checking the queue again, pairs with the fence in WakeConsumer
+    waiters_.fetch_add(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (wait_us < 0) {
+        ready_.wait(lk, ready);
+    } else {
+        ready_.wait_for(lk, std::chrono::microseconds(wait_us), ready);
+    }
+    waiters_.fetch_sub(1);
+
+    return popped;
+}
+
+template<typename T>
+void BoundedQueue<T>::WakeConsumer() {
+    // Either the waiter sees the pushed value or this sees the waiter
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters_.load(std::memory_order_relaxed) > 0) {
+        std::lock_guard<std::mutex> lk(mutex_);
+        ready_.notify_one();
+    }
+}
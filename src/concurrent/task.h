@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Move-only void() callable. Callables up to kInlineSize bytes are stored in place,
+// which covers the lambdas of the renderer and the BVH build, larger ones go to the heap.
+class Task {
+public:
+    static constexpr size_t kInlineSize = 48;
+
+    Task() : ops_(nullptr) {}
+
+    template<typename F, typename = std::enable_if_t<!std::is_same<std::decay_t<F>, Task>::value>>
+    Task(F&& f) {
+        using Fn = std::decay_t<F>;
+        if constexpr (IsInline<Fn>()) {
+            new (storage_) Fn(std::forward<F>(f));
+            ops_ = &InlineOps<Fn>::kOps;
+        } else {
+            *reinterpret_cast<Fn**>(storage_) = new Fn(std::forward<F>(f));
+            ops_ = &HeapOps<Fn>::kOps;
+        }
+    }
+
+    Task(Task&& other) noexcept : ops_(other.ops_) {
+        if (ops_) {
+            ops_->move(storage_, other.storage_);
+            other.ops_ = nullptr;
+        }
+    }
+
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            ops_ = other.ops_;
+            if (ops_) {
+                ops_->move(storage_, other.storage_);
+                other.ops_ = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() { Reset(); }
+
+    void operator()() { ops_->invoke(storage_); }
+    explicit operator bool() const { return ops_ != nullptr; }
+
+    void Reset() {
+        if (ops_) {
+            ops_->destroy(storage_);
+            ops_ = nullptr;
+        }
+    }
+
+private:
+    struct Ops {
+        void (*invoke)(void* storage);
+        void (*move)(void* dst, void* src); // move constructs dst and destroys src
+        void (*destroy)(void* storage);
+    };
+
+    template<typename Fn>
+    static constexpr bool IsInline() {
+        return sizeof(Fn) <= kInlineSize && alignof(Fn) <= alignof(std::max_align_t) &&
+            std::is_nothrow_move_constructible<Fn>::value;
+    }
+
+    template<typename Fn>
+    struct InlineOps {
+        static void Invoke(void* storage) { (*static_cast<Fn*>(storage))(); }
+        static void Move(void* dst, void* src) {
+            new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+            static_cast<Fn*>(src)->~Fn();
+        }
+        static void Destroy(void* storage) { static_cast<Fn*>(storage)->~Fn(); }
+
+        static constexpr Ops kOps = { Invoke, Move, Destroy };
+    };
+
+    template<typename Fn>
+    struct HeapOps {
+        static void Invoke(void* storage) { (**static_cast<Fn**>(storage))(); }
+        static void Move(void* dst, void* src) { *static_cast<Fn**>(dst) = *static_cast<Fn**>(src); }
+        static void Destroy(void* storage) { delete *static_cast<Fn**>(storage); }
+
+        static constexpr Ops kOps = { Invoke, Move, Destroy };
+    };
+
+    alignas(std::max_align_t) unsigned char storage_[kInlineSize];
+    const Ops* ops_;
+};
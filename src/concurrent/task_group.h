@@ -0,0 +1,42 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <utility>
+#include "common/uncopyable.h"
+#include "thread_pool.h"
+
+// Fork-join helper on top of ThreadPool. Tasks run inline when there is no pool.
+// Wait() runs queued tasks while its own are pending, so tasks may spawn and
+// wait on subtasks from inside the pool without starving it.
+class TaskGroup : private Uncopyable {
+public:
+    TaskGroup(ThreadPool* pool) : pool_(pool), pending_(0) {}
+    ~TaskGroup() { Wait(); }
+
+    template<typename F>
+    void Run(F&& f) {
+        if (!pool_) {
+            f();
+            return;
+        }
+
+        pending_.fetch_add(1, std::memory_order_relaxed);
+        pool_->Enqueue([this, f = std::forward<F>(f)]() mutable {
+            f();
+            pending_.fetch_sub(1, std::memory_order_release);
+        });
+    }
+
+    void Wait() {
+        while (pending_.load(std::memory_order_acquire) > 0) {
+            if (!pool_->RunPending()) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+private:
+    ThreadPool* pool_;
+    std::atomic<int> pending_;
+};
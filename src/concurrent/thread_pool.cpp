@@ -3,26 +3,62 @@
 #include <utility>
 #include <iostream>
 
+namespace {
+
+thread_local ThreadPool* t_pool = nullptr;
+thread_local int t_worker = -1;
+
+// Finished tasks are kept per thread and reused, so enqueueing does not allocate
+// once a thread has warmed up. Tasks migrate to the cache of the thread that ran them.
+struct TaskCache {
+    static constexpr size_t kMaxSize = 256;
+
+    ~TaskCache() {
+        for (auto task : tasks) {
+            delete task;
+        }
+    }
+
+    Task* Acquire(Task&& task) {
+        if (tasks.empty()) {
+            return new Task(std::move(task));
+        }
+
+        Task* cached = tasks.back();
+        tasks.pop_back();
+        *cached = std::move(task);
+        return cached;
+    }
+
+    void Release(Task* task) {
+        task->Reset();
+        if (tasks.size() < kMaxSize) {
+            tasks.push_back(task);
+        } else {
+            delete task;
+        }
+    }
+
+    std::vector<Task*> tasks;
+};
+
+thread_local TaskCache t_task_cache;
+
+}
+
 ThreadPool::ThreadPool(int threads): 
+    injection_size_(0),
+    pending_(0),
+    sleepers_(0),
     exit_(false)
 {
     for (int i = 0; i < threads; ++i) {
-        threads_.emplace_back([this] {
-            while (true) {
-                Task task;
-                {
-                    std::unique_lock<std::mutex> lk(mutex_);
-                    ready_.wait(lk, [this]{ return exit_ || !tasks_.empty(); });
-                    if (exit_ && tasks_.empty()) {
-                        return;
-                    }
-                    
-                    task = std::move(tasks_.front());
-                    tasks_.pop_front();
-                }
-                
-                task();
-            }
+        deques_.emplace_back(new TaskDeque());
+    }
+
+    for (int i = 0; i < threads; ++i) {
+        threads_.emplace_back([this, i] {
+            WorkerLoop(i);
         });
     }
 }
@@ -31,11 +67,80 @@ ThreadPool::~ThreadPool() {
     Join();
 }
 
+void ThreadPool::WorkerLoop(int index) {
+    t_pool = this;
+    t_worker = index;
+
+    while (true) {
+        Task* task = FindTask(index);
+        if (task) {
+            RunTask(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lk(mutex_);
+        sleepers_.fetch_add(1);
+        ready_.wait(lk, [this]{ return exit_.load() || pending_.load() > 0; });
+        sleepers_.fetch_sub(1);
+        if (exit_.load() && pending_.load() == 0) {
+            break;
+        }
+    }
+
+    t_pool = nullptr;
+    t_worker = -1;
+}
+
+ThreadPool::Task* ThreadPool::FindTask(int index) {
+    Task* task = nullptr;
+    if (index >= 0 && deques_[index]->Pop(task)) {
+        pending_.fetch_sub(1, std::memory_order_relaxed);
+        return task;
+    }
+
+    if (injection_size_.load(std::memory_order_acquire) > 0) {
+        std::lock_guard<std::mutex> lk(injection_mutex_);
+        if (!injection_.empty()) {
+            // Workers take the oldest task. A thread outside the pool only gets here from
+            // RunPending, it takes the newest, usually the subtask it is waiting on, which
+            // keeps its nested waits depth-first and its stack bounded.
+            if (index >= 0) {
+                task = injection_.front();
+                injection_.pop_front();
+            } else {
+                task = injection_.back();
+                injection_.pop_back();
+            }
+            injection_size_.fetch_sub(1, std::memory_order_relaxed);
+            pending_.fetch_sub(1, std::memory_order_relaxed);
+            return task;
+        }
+    }
+
+    // Start from the next worker so thieves spread over the victims
+    int count = static_cast<int>(deques_.size());
+    for (int i = 1; i <= count; ++i) {
+        int victim = (index + i + count) % count;
+        if (victim == index) continue;
+        if (deques_[victim]->Steal(task)) {
+            pending_.fetch_sub(1, std::memory_order_relaxed);
+            return task;
+        }
+    }
+
+    return nullptr;
+}
+
+void ThreadPool::RunTask(Task* task) {
+    (*task)();
+    t_task_cache.Release(task);
+}
+
 void ThreadPool::Join() {
     {
         std::lock_guard<std::mutex> lk(mutex_);
-        if (exit_) return;
-        exit_ = true;
+        if (exit_.load()) return;
+        exit_.store(true);
     }
     
     ready_.notify_all();
@@ -45,12 +150,36 @@ void ThreadPool::Join() {
     }
 }
 
+bool ThreadPool::RunPending() {
+    Task* task = FindTask(t_pool == this ? t_worker : -1);
+    if (!task) {
+        return false;
+    }
+
+    RunTask(task);
+    return true;
+}
+
 void ThreadPool::Enqueue(Task&& task) {
-    {
-        std::lock_guard<std::mutex> lk(mutex_);
-        if (exit_) return;
+    bool worker = t_pool == this;
+    // Tasks from outside are refused once joining, subtasks of running tasks are not
+    if (!worker && exit_.load()) return;
+
+    // Counted before it is visible, so a thief never drives pending_ below zero.
+    // Pairs with the sleepers_ increment before a worker checks pending_ and waits.
+    pending_.fetch_add(1);
 
-        tasks_.push_back(std::move(task));
+    Task* queued = t_task_cache.Acquire(std::move(task));
+    if (worker) {
+        deques_[t_worker]->Push(queued);
+    } else {
+        std::lock_guard<std::mutex> lk(injection_mutex_);
+        injection_.push_back(queued);
+        injection_size_.fetch_add(1, std::memory_order_release);
+    }
+
+    if (sleepers_.load() > 0) {
+        std::lock_guard<std::mutex> lk(mutex_);
+        ready_.notify_one();
     }
-    ready_.notify_one();
 }
@@ -2,46 +2,68 @@
 
 #include <thread>
 #include <atomic>
+#include <deque>
 #include <vector>
-#include <list>
+#include <memory>
 #include <functional>
 #include <limits>
 #include <condition_variable>
 #include <mutex>
 #include "common/uncopyable.h"
-#include "blocking_queue.h"
+#include "task.h"
+#include "work_stealing_deque.h"
 
+// Work-stealing pool. Every worker owns a Chase-Lev deque: tasks enqueued from a worker
+// (subtasks) go to its own deque and are popped LIFO, idle workers steal FIFO from the
+// others. Tasks enqueued from outside the pool go through a shared injection queue.
 class ThreadPool: private Uncopyable {
 public:
-    using Task = std::function<void()>;
+    using Task = ::Task;
 
     ThreadPool(int threads);
     ~ThreadPool();
 
     size_t size() { return threads_.size(); }
-    size_t task_size() { return tasks_.size(); }
+    // Tasks queued and not yet started
+    size_t task_size() { return static_cast<size_t>(pending_.load(std::memory_order_relaxed)); }
 
+    // Runs every queued task, including the ones they spawn, then stops the workers
     void Join();
 
+    // Run one queued task on the calling thread, false if there was none.
+    // Lets a thread waiting on its own subtasks help instead of blocking a worker.
+    bool RunPending();
+
     void Enqueue(Task&& task);
 
     template<typename F, typename... Args>
     void Enqueue(F&& f, Args&&... args) {
-        {
-            std::lock_guard<std::mutex> lk(mutex_);
-            if (exit_) return;
-            
-            auto task = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
-            tasks_.push_back(std::move(task));
+        if constexpr (sizeof...(Args) == 0) {
+            Enqueue(Task(std::forward<F>(f)));
+        } else {
+            Enqueue(Task(std::bind(std::forward<F>(f), std::forward<Args>(args)...)));
         }
-        ready_.notify_one();
     }
 
 private:
-    std::list<Task> tasks_;
+    using TaskDeque = WorkStealingDeque<Task*>;
+
+    void WorkerLoop(int index);
+    // index is the calling worker, -1 for a thread outside the pool
+    Task* FindTask(int index);
+    void RunTask(Task* task);
+
+    std::vector<std::unique_ptr<TaskDeque>> deques_;
     std::vector<std::thread> threads_;
+
+    std::mutex injection_mutex_;
+    std::deque<Task*> injection_;
+    std::atomic<int> injection_size_;
+
+    std::atomic<int> pending_;
+    std::atomic<int> sleepers_;
     std::mutex mutex_;
     std::condition_variable ready_;
 
-    bool exit_;
+    std::atomic<bool> exit_;
 };
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+#include "common/uncopyable.h"
+
+// Chase-Lev deque, with the memory orderings of Le et al., "Correct and Efficient
+// Work-Stealing for Weak Memory Models" (PPoPP 2013). The owner thread pushes and pops
+// at the bottom, any thread steals from the top. T must be trivially copyable, pools
+// store task pointers.
+template<typename T>
+class WorkStealingDeque : private Uncopyable {
+    static_assert(std::is_trivially_copyable<T>::value, "WorkStealingDeque stores trivially copyable values");
+
+public:
+    explicit WorkStealingDeque(int64_t capacity = 256) : top_(0), bottom_(0) {
+        arrays_.emplace_back(new Array(capacity));
+        array_.store(arrays_.back().get(), std::memory_order_relaxed);
+    }
+
+    // Owner only
+    void Push(T value) {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_acquire);
+        Array* a = array_.load(std::memory_order_relaxed);
+        if (b - t > a->capacity - 1) {
+            a = Grow(a, t, b);
+        }
+        a->Put(b, value);
+        // Publishes the element like the paper's release fence, in a form ThreadSanitizer understands
+        bottom_.store(b + 1, std::memory_order_release);
+    }
+
+    // Owner only, takes the most recently pushed value
+    bool Pop(T& value) {
+        int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        Array* a = array_.load(std::memory_order_relaxed);
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_relaxed);
+
+        if (t > b) {
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        value = a->Get(b);
+        if (t == b) {
+            // Last element, race the thieves for it
+            bool won = top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    // Any thread, takes the oldest value. Fails spuriously when another thread wins the race.
+    bool Steal(T& value) {
+        int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom_.load(std::memory_order_acquire);
+        if (t >= b) return false;
+
+        Array* a = array_.load(std::memory_order_acquire);
+        T v = a->Get(t);
+        if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return false;
+        }
+        value = v;
+        return true;
+    }
+
+    bool empty() const {
+        return bottom_.load(std::memory_order_relaxed) <= top_.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Array {
+        explicit Array(int64_t c) : capacity(c), mask(c - 1), data(new std::atomic<T>[c]) {}
+
+        T Get(int64_t i) const { return data[i & mask].load(std::memory_order_relaxed); }
+        void Put(int64_t i, T v) { data[i & mask].store(v, std::memory_order_relaxed); }
+
+        int64_t capacity; // power of two
+        int64_t mask;
+        std::unique_ptr<std::atomic<T>[]> data;
+    };
+
+    Array* Grow(Array* a, int64_t t, int64_t b) {
+        Array* grown = new Array(a->capacity * 2);
+        for (int64_t i = t; i < b; ++i) {
+            grown->Put(i, a->Get(i));
+        }
+        // Thieves may still read the old array, it is released with the deque
+        arrays_.emplace_back(grown);
+        array_.store(grown, std::memory_order_release);
+        return grown;
+    }
+
+    alignas(64) std::atomic<int64_t> top_;
+    alignas(64) std::atomic<int64_t> bottom_;
+    std::atomic<Array*> array_;
+    std::vector<std::unique_ptr<Array>> arrays_;
+};
@@ -0,0 +1,64 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "concurrent/blocking_queue.h"
+#include "concurrent/bounded_queue.h"
+
+// Throughput of BoundedQueue against BlockingQueue with as many producers as consumers:
+//   bench_queue [items] [capacity]
+// Items are heap allocated like the tiles and tasks the renderer passes around.
+template<typename Q>
+bool Run(const char* name, int threads, long items, int capacity) {
+    Q queue(capacity);
+    const long per_thread = items / threads;
+    std::atomic<long> sum(0);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; ++i) {
+        workers.emplace_back([&] {
+            for (long v = 1; v <= per_thread; ++v) {
+                auto item = std::make_unique<long>(v);
+                while (!queue.TryPush(std::move(item))) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (int i = 0; i < threads; ++i) {
+        workers.emplace_back([&] {
+            long local = 0;
+            for (long n = 0; n < per_thread; ++n) {
+                std::unique_ptr<long> item;
+                while (!queue.WaitPop(item, 1000)) {}
+                local += *item;
+            }
+            sum.fetch_add(local, std::memory_order_relaxed);
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    bool ok = sum.load() == threads * (per_thread * (per_thread + 1) / 2);
+    std::cout << name << " " << threads << "p/" << threads << "c: " << seconds << "s, "
+        << static_cast<long>(per_thread * threads / seconds) << " items/s" << (ok ? "" : " (WRONG SUM)") << std::endl;
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    long items = argc > 1 ? std::atol(argv[1]) : 400000;
+    int capacity = argc > 2 ? std::atoi(argv[2]) : 1024;
+
+    bool ok = true;
+    for (int threads : {1, 4, 16}) {
+        ok &= Run<BlockingQueue<std::unique_ptr<long>>>("blocking", threads, items, capacity);
+        ok &= Run<BoundedQueue<std::unique_ptr<long>>>("bounded ", threads, items, capacity);
+    }
+    return ok ? 0 : 1;
+}
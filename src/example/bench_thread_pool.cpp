@@ -0,0 +1,56 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include "concurrent/task_group.h"
+#include "concurrent/thread_pool.h"
+
+// Microbenchmark of ThreadPool scheduling overhead:
+//   bench_thread_pool [threads] [tasks] [depth]
+// "flat" enqueues <tasks> trivial tasks from the main thread, "nested" runs a binary
+// TaskGroup tree of <depth> levels where every task forks two subtasks and waits on them.
+int main(int argc, char** argv) {
+    int threads = argc > 1 ? std::atoi(argv[1]) : static_cast<int>(std::thread::hardware_concurrency());
+    long tasks = argc > 2 ? std::atol(argv[2]) : 1000000;
+    int depth = argc > 3 ? std::atoi(argv[3]) : 18;
+    using Clock = std::chrono::steady_clock;
+
+    std::atomic<long> sum(0);
+    auto t0 = Clock::now();
+    {
+        ThreadPool pool(threads);
+        for (long i = 0; i < tasks; ++i) {
+            pool.Enqueue([&sum, i] { sum.fetch_add(i, std::memory_order_relaxed); });
+        }
+        pool.Join();
+    }
+    auto t1 = Clock::now();
+    bool flat_ok = sum.load() == tasks * (tasks - 1) / 2;
+    std::cout << "flat:   " << tasks << " tasks, " << std::chrono::duration<double>(t1 - t0).count() << "s"
+        << (flat_ok ? "" : " (WRONG SUM)") << std::endl;
+
+    std::atomic<long> leaves(0);
+    {
+        ThreadPool pool(threads);
+        std::function<void(int)> fork = [&](int level) {
+            if (level == 0) {
+                leaves.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            TaskGroup group(&pool);
+            group.Run([&, level] { fork(level - 1); });
+            group.Run([&, level] { fork(level - 1); });
+            group.Wait();
+        };
+        TaskGroup group(&pool);
+        group.Run([&] { fork(depth); });
+        group.Wait();
+    }
+    auto t2 = Clock::now();
+    bool nested_ok = leaves.load() == (1L << depth);
+    std::cout << "nested: " << (1L << (depth + 1)) - 1 << " tasks, " << std::chrono::duration<double>(t2 - t1).count() << "s"
+        << (nested_ok ? "" : " (WRONG COUNT)") << std::endl;
+
+    return flat_ok && nested_ok ? 0 : 1;
+}
@@ -0,0 +1,90 @@
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "camera.h"
+#include "hittable/hittable_list.h"
+#include "hittable/sphere.h"
+#include "material.h"
+#include "renderer.h"
+#include "shard.h"
+
+// Checks that the merged shards of a split resume like a checkpoint of the whole frame:
+//   check_merge_resume [samples per pixel]
+// Both a tile split and a sample split are rendered by shards and merged. A whole frame
+// render resuming from the merged state must take it as complete, trace no pass and hold
+// the same samples. Exits with 1 when a check fails.
+
+namespace {
+
+HittableList gen_scene() {
+    HittableList world;
+
+    auto white = std::make_shared<Lambertian>(Color(.73, .73, .73));
+    world.Add(std::make_shared<Sphere>(Vec3f(0,-1000,0), 1000, white));
+    world.Add(std::make_shared<Sphere>(Vec3f(0,2,0), 2, white));
+
+    auto difflight = std::make_shared<DiffuseLight>(Color(4,4,4));
+    world.Add(std::make_shared<Sphere>(Vec3f(0,7,0), 2, difflight));
+
+    return world;
+}
+
+const Camera kCamera(Vec3f(26,3,6), Vec3f(0, 2, 0), Vec3f(0, 1, 0), 20, 16.0 / 9.0, 0.0, 10);
+
+bool CheckResume(const std::string& dir, ShardMode mode, int count, int samples) {
+    std::vector<std::string> paths;
+    for (int i = 0; i < count; ++i) {
+        Renderer r(samples);
+        auto world = gen_scene();
+        r.BuildWorld(world, BvhOptions(), 2);
+
+        FrameBuffer image(32, 18);
+        ShardSpec shard{ i, count, mode };
+        if (!RenderShard(r, kCamera, image, dir, shard, 2)) {
+            return false;
+        }
+        paths.push_back(ShardPath(dir, shard));
+    }
+
+    FrameState merged;
+    std::string merged_path = (std::filesystem::path(dir) / "merged.state").string();
+    if (!MergeFrameStates(paths, merged) || !merged.Save(merged_path)) {
+        return false;
+    }
+
+    Renderer r(samples);
+    auto world = gen_scene();
+    r.BuildWorld(world, BvhOptions(), 2);
+    r.spec().checkpoint_path = merged_path;
+
+    FrameBuffer image(32, 18);
+    int passes = 0;
+    r.RenderProgressive(kCamera, image, [&](int, const FrameBuffer&) { ++passes; return true; }, 2);
+
+    const FrameState& frame = r.frame_state();
+    bool same = frame.TotalSamples() == merged.TotalSamples();
+    for (size_t i = 0; same && i < frame.sums.size(); ++i) {
+        same = frame.sums.data()[i] == merged.sums.data()[i];
+    }
+    if (passes != 0 || !same) {
+        std::cerr << "the merged " << ShardModeName(mode) << " split did not resume as the whole frame" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+}
+
+int main(int argc, char** argv) {
+    int samples = argc > 1 ? std::atoi(argv[1]) : 8;
+
+    std::string dir = (std::filesystem::temp_directory_path() / "raytoy_check_merge_resume").string();
+    std::filesystem::remove_all(dir);
+
+    bool ok = CheckResume(dir, ShardMode::kTiles, 3, samples);
+    ok = CheckResume(dir, ShardMode::kSamples, 3, samples) && ok;
+
+    std::filesystem::remove_all(dir);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,96 @@
+#include <cmath>
+#include <iostream>
+#include "camera.h"
+#include "hittable/hittable_list.h"
+#include "hittable/sphere.h"
+#include "material.h"
+#include "math/random.h"
+#include "renderer.h"
+
+// Checks that light sampling a sphere emitter agrees with finding it by BSDF rays only:
+//   check_sphere_light [samples per pixel]
+// The sampled directions must fall in the cone Sphere::PDF describes, and the mean of a
+// frame lit by one diffuse sphere (the simple_light setup) must not depend on whether
+// next event estimation is on. Exits with 1 when either check fails.
+
+namespace {
+
+HittableList gen_scene() {
+    HittableList world;
+
+    auto white = std::make_shared<Lambertian>(Color(.73, .73, .73));
+    world.Add(std::make_shared<Sphere>(Vec3f(0,-1000,0), 1000, white));
+    world.Add(std::make_shared<Sphere>(Vec3f(0,2,0), 2, white));
+
+    auto difflight = std::make_shared<DiffuseLight>(Color(4,4,4));
+    world.Add(std::make_shared<Sphere>(Vec3f(0,7,0), 2, difflight));
+
+    return world;
+}
+
+bool CheckSampleDirections() {
+    Sphere sphere(Vec3f(0, 7, 0), 2, nullptr);
+    math::Rand rng(1, 1);
+    Vec3f origins[] = { Vec3f(0, 0, 0), Vec3f(5, 1, -3), Vec3f(0, 12, 0), Vec3f(-2, 7, 4) };
+    for (const auto& o : origins) {
+        for (int i = 0; i < 1000; ++i) {
+            Vec3f v = sphere.Sample(o, rng);
+            if (!(sphere.PDF(o, v) > 0)) {
+                std::cerr << "sampled direction (" << v.x << ", " << v.y << ", " << v.z << ") from ("
+                    << o.x << ", " << o.y << ", " << o.z << ") misses the sphere" << std::endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Mean linear radiance of the frame, per channel and sample
+XFloat RenderMean(LightSampling sampling, uint64_t seed, int samples) {
+    Renderer r(samples);
+    r.spec().light_sampling = sampling;
+    r.spec().seed = seed;
+    auto world = gen_scene();
+    r.BuildWorld(world);
+
+    FrameBuffer image(64, 36);
+    Camera camera(Vec3f(26,3,6), Vec3f(0, 2, 0), Vec3f(0, 1, 0), 20, 16.0 / 9.0, 0.0, 10);
+    r.Render(camera, image);
+
+    const FrameState& frame = r.frame_state();
+    XFloat sum = 0;
+    uint64_t count = 0;
+    for (size_t i = 0; i < frame.sums.size(); ++i) {
+        const Color& c = frame.sums.data()[i];
+        sum += c.r + c.g + c.b;
+        count += frame.variance.data()[i].count;
+    }
+    return count > 0 ? sum / (3 * count) : 0;
+}
+
+}
+
+int main(int argc, char** argv) {
+    int samples = argc > 1 ? std::atoi(argv[1]) : 64;
+
+    bool ok = CheckSampleDirections();
+
+    // Both estimators are unbiased, their means only differ by noise. The frames are
+    // small enough for that to stay well under the tolerance.
+    constexpr XFloat kTolerance = 0.04;
+    XFloat nee = 0, bsdf = 0;
+    for (uint64_t seed = 1; seed <= 3; ++seed) {
+        nee += RenderMean(LightSampling::kBvh, seed, samples);
+        bsdf += RenderMean(LightSampling::kNone, seed, samples);
+    }
+
+    XFloat difference = std::fabs(nee - bsdf) / bsdf;
+    std::cout << "mean with light sampling " << nee / 3 << ", BSDF sampling only " << bsdf / 3
+        << ", relative difference " << difference << std::endl;
+    if (!(difference < kTolerance)) {
+        std::cerr << "light sampling a sphere changes the mean of the frame" << std::endl;
+        ok = false;
+    }
+
+    return ok ? 0 : 1;
+}
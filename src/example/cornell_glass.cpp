@@ -65,7 +65,6 @@ int main() {
         10 //dist_to_focus
     );
 
-    r.lights()->Add(std::make_shared<Sphere>(Vec3f(190, 90, 190), 90, std::shared_ptr<Material>()));
     r.Render(camera, image);
 
     write_png_image("output.png", image.width(), image.height(), 3, (const void*)image.data().data(), 0);
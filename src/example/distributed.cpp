@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "camera.h"
+#include "hittable/hittable_list.h"
+#include "material.h"
+#include "common/image.h"
+#include "math/vec3.h"
+#include "util.h"
+#include "renderer.h"
+#include "shard.h"
+#include "hittable/aarect.h"
+#include "hittable/box.h"
+#ifdef __unix__
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// Cornell box rendered by several processes sharing a directory:
+//   distributed [workers] [tiles|samples]            forks the workers and merges their shards
+//   distributed worker <index> <count> [tiles|samples] [threads]
+//                                                    runs one worker, e.g. from another shell or
+//                                                    machine, on every core unless threads is given
+//   distributed merge <count> [tiles|samples]        waits for the shards and writes output.png
+
+constexpr int kImageSize = 600;
+constexpr int kSamplesPerPixel = 2000;
+constexpr const char* kShardDir = "shards";
+
+HittableList gen_scene() {
+    HittableList world;
+
+    auto red   = std::make_shared<Lambertian>(Color(.65, .05, .05));
+    auto white = std::make_shared<Lambertian>(Color(.73, .73, .73));
+    auto green = std::make_shared<Lambertian>(Color(.12, .45, .15));
+    auto light = std::make_shared<DiffuseLight>(Color(15,15,15));
+
+    world.Add(std::make_shared<AARect<math::Axis::kX>>(0, 555, 0, 555, 0, green));
+    world.Add(std::make_shared<AARect<math::Axis::kX>>(0, 555, 0, 555, 555, red));
+    world.Add(std::make_shared<AARect<math::Axis::kY, false>>(213, 343, 227, 332, 554, light));
+    world.Add(std::make_shared<AARect<math::Axis::kY>>(0, 555, 0, 555, 555, white));
+    world.Add(std::make_shared<AARect<math::Axis::kY>>(0, 555, 0, 555, 0, white));
+    world.Add(std::make_shared<AARect<math::Axis::kZ>>(0, 555, 0, 555, 555, white));
+
+    std::shared_ptr<Hittable> box1 = std::make_shared<Box>(Vec3f(192,165,295 + 82.5), Quaternion::AngleAxis(-15, Vec3f::up), Vec3f(82.5,165,82.5), white);
+    world.Add(box1);
+
+    std::shared_ptr<Hittable> box2 = std::make_shared<Box>(Vec3f(367,0 + 82.5,65 + 82.5), Quaternion::AngleAxis(18, Vec3f::up), Vec3f(82.5,82.5,82.5), white);
+    world.Add(box2);
+
+    return world;
+}
+
+ShardMode ParseMode(int argc, char** argv, int index) {
+    return argc > index && std::string(argv[index]) == "samples" ? ShardMode::kSamples : ShardMode::kTiles;
+}
+
+int RunWorker(const ShardSpec& shard, int parallel) {
+    Renderer r(kSamplesPerPixel);
+    auto world = gen_scene();
+    r.BuildWorld(world);
+
+    FrameBuffer image(kImageSize, kImageSize);
+    Camera camera(
+        Vec3f(278, 278, -800), //pos
+        Vec3f(278, 278, 0), //look at pos
+        Vec3f(0, 1, 0), //up vector
+        40, //fov
+        1.0, //aspect ratio
+        0.0, //aperture
+        10 //dist_to_focus
+    );
+
+    return RenderShard(r, camera, image, kShardDir, shard, parallel) ? 0 : 1;
+}
+
+int RunMerge(int count, ShardMode mode) {
+    FrameState merged;
+    if (!WaitForShards(kShardDir, count, mode, merged)) {
+        return 1;
+    }
+
+    FrameBuffer image(merged.width(), merged.height());
+    merged.Resolve(image);
+    write_png_image("output.png", image.width(), image.height(), 3, (const void*)image.data().data(), 0);
+    std::cerr << "Merged " << count << " shards, " << static_cast<double>(merged.TotalSamples()) / merged.variance.size()
+        << " spp on average" << std::endl;
+    return 0;
+}
+
+// A sample split needs at least one sample per pixel for every shard
+bool CheckSplit(int count, ShardMode mode) {
+    if (!ShardSpec{ 0, count, mode }.Fits(kSamplesPerPixel)) {
+        std::cerr << "Cannot split " << kSamplesPerPixel << " samples per pixel into " << count << " shards" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+constexpr const char* kUsage = "usage: distributed [workers] [tiles|samples] | worker <index> <count> [tiles|samples] [threads] | merge <count> [tiles|samples]";
+
+int main(int argc, char** argv) {
+    std::string command = argc > 1 ? argv[1] : "";
+
+    if (command == "worker" && argc > 3) {
+        ShardSpec shard{ std::atoi(argv[2]), std::atoi(argv[3]), ParseMode(argc, argv, 4) };
+        if (!shard.Valid()) {
+            std::cerr << "The worker index must be in [0, count) and count at least 1" << std::endl << kUsage << std::endl;
+            return 1;
+        }
+        if (!CheckSplit(shard.count, shard.mode)) {
+            return 1;
+        }
+        int parallel = argc > 5 ? std::atoi(argv[5]) : static_cast<int>(std::thread::hardware_concurrency());
+        return RunWorker(shard, std::max(1, parallel));
+    }
+    if (command == "merge" && argc > 2) {
+        int count = std::atoi(argv[2]);
+        if (count < 1) {
+            std::cerr << "The shard count must be at least 1" << std::endl << kUsage << std::endl;
+            return 1;
+        }
+        ShardMode mode = ParseMode(argc, argv, 3);
+        if (!CheckSplit(count, mode)) {
+            return 1;
+        }
+        return RunMerge(count, mode);
+    }
+
+    int workers = argc > 1 ? std::atoi(argv[1]) : 4;
+    if (workers < 1) {
+        std::cerr << kUsage << std::endl;
+        return 1;
+    }
+
+#ifdef __unix__
+    ShardMode mode = ParseMode(argc, argv, 2);
+    if (!CheckSplit(workers, mode)) {
+        return 1;
+    }
+    RemoveShards(kShardDir, workers, mode);
+    // Every worker traces on its own cores, the scene is built after the fork
+    int parallel = std::max(1, static_cast<int>(std::thread::hardware_concurrency()) / workers);
+    std::vector<pid_t> pids;
+    for (int i = 0; i < workers; ++i) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            std::exit(RunWorker(ShardSpec{ i, workers, mode }, parallel));
+        }
+        if (pid < 0) {
+            std::cerr << "Cannot start worker " << i << std::endl;
+            while (wait(nullptr) > 0) {}
+            return 1;
+        }
+        pids.push_back(pid);
+    }
+
+    // A worker that fails never writes its shard, the merge would wait for it forever
+    bool failed = false;
+    for (int i = 0; i < workers; ++i) {
+        int status = 0;
+        if (waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            std::cerr << "Worker " << i << " failed" << std::endl;
+            failed = true;
+        }
+    }
+    return failed ? 1 : RunMerge(workers, mode);
+#else
+    std::cerr << "Start the workers with 'distributed worker <index> " << workers << "', then run 'distributed merge "
+        << workers << "' with the same split" << std::endl;
+    return 1;
+#endif
+}
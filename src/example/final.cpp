@@ -80,7 +80,9 @@ HittableList gen_scene() {
 int main() {
     // Render
     Renderer r(10000);
-    
+    // Rerunning after an interruption picks the render up where it stopped
+    r.spec().checkpoint_path = "final.ckpt";
+
     // World
     auto world = gen_scene();
     r.BuildWorld(world);
@@ -104,7 +106,9 @@ int main() {
         1
     );
 
-    r.Render(camera, image, 10, 128);
-
-    write_png_image("output.png", image.width(), image.height(), 3, (const void*)image.data().data(), 0);
+    // Each pass doubles the samples, output.png is refreshed so the render can be stopped early
+    r.RenderProgressive(camera, image, [](int, const FrameBuffer& snapshot) {
+        write_png_image("output.png", snapshot.width(), snapshot.height(), 3, (const void*)snapshot.data().data(), 0);
+        return true;
+    }, 10);
 }
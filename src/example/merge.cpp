@@ -0,0 +1,46 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include "common/image.h"
+#include "frame_state.h"
+#include "shard.h"
+
+// Merges frame states of the same frame, e.g. shards rendered by separate processes or
+// copied from other machines, and writes the tone-mapped result:
+//   merge <output.png> <state> [<state> ...] [-o <merged state>]
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "usage: merge <output.png> <state> [<state> ...] [-o <merged state>]" << std::endl;
+        return 1;
+    }
+
+    std::string output = argv[1];
+    std::string merged_path;
+    std::vector<std::string> paths;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc) {
+            merged_path = argv[++i];
+        } else {
+            paths.push_back(arg);
+        }
+    }
+
+    FrameState merged;
+    if (!MergeFrameStates(paths, merged)) {
+        return 1;
+    }
+
+    FrameBuffer image(merged.width(), merged.height());
+    merged.Resolve(image);
+    write_png_image(output.c_str(), image.width(), image.height(), 3, (const void*)image.data().data(), 0);
+
+    // The merged state resumes like a checkpoint when the samples of the inputs were contiguous
+    if (!merged_path.empty() && !merged.Save(merged_path)) {
+        return 1;
+    }
+
+    std::cerr << "Merged " << paths.size() << " states, " << static_cast<double>(merged.TotalSamples()) / merged.variance.size()
+        << " spp on average" << std::endl;
+    return 0;
+}
@@ -0,0 +1,306 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+#include "common/buffer.h"
+#include "common/uncopyable.h"
+#include "math/vec3.h"
+#include "util.h"
+
+using FrameBuffer = Buffer<math::Vec3<uint8_t>>;
+// Linear radiance summed over the samples traced so far
+using AccumulationBuffer = Buffer<Color>;
+
+// Sample count and running luminance variance of a pixel (Welford's algorithm)
+struct PixelVariance {
+    // Floor of the mean in the relative error, so black pixels converge
+    static constexpr XFloat kMinMean = 0.01;
+
+    int count = 0;
+    XFloat mean = 0;
+    XFloat m2 = 0;
+
+    void Add(XFloat value) {
+        ++count;
+        XFloat delta = value - mean;
+        mean += delta / count;
+        m2 += delta * (value - mean);
+    }
+
+    // Combines the statistics of another set of samples (Chan et al.)
+    void Merge(const PixelVariance& other) {
+        if (other.count == 0) return;
+        if (count == 0) {
+            *this = other;
+            return;
+        }
+
+        int total = count + other.count;
+        XFloat delta = other.mean - mean;
+        mean += delta * other.count / total;
+        m2 += other.m2 + delta * delta * count * other.count / total;
+        count = total;
+    }
+
+    // Standard error of the mean relative to the square root of the mean, which
+    // roughly follows the error after gamma correction
+    XFloat RelativeError() const {
+        if (count < 2) return math::kInfinite;
+        XFloat variance = m2 / (count - 1);
+        return std::sqrt(variance / count) / std::sqrt(math::Max(mean, kMinMean));
+    }
+};
+
+// Per-pixel sample state of a frame, which is all a render needs to go on: samples are
+// seeded from (seed, pixel, sample index), so the sample counts double as RNG counters.
+// Saved as a checkpoint to resume a render, and partial states of the same frame traced
+// by different processes merge by adding them up.
+//
+// File layout, little endian: magic, version, width, height (uint32), seed, scene hash
+// (uint64), first sample index, shard mode, shard count, number of shards held and their
+// indices (uint32), then per pixel in row order the color sum (3 doubles), sample count
+// (int32), luminance mean and m2 (doubles), and nothing after the last pixel.
+struct FrameState : private Uncopyable {
+    static constexpr uint32_t kMagic = 0x4b435452; // "RTCK"
+    static constexpr uint32_t kVersion = 3;
+    // Color sum, sample count, luminance mean and m2 of a pixel in the file
+    static constexpr uint64_t kPixelBytes = 3 * sizeof(double) + sizeof(int32_t) + 2 * sizeof(double);
+
+    FrameState() = default;
+
+    int width() const { return sums.width(); }
+    int height() const { return sums.height(); }
+
+    void Reset(int w, int h, uint64_t frame_seed, uint64_t frame_hash) {
+        seed = frame_seed;
+        scene_hash = frame_hash;
+        sample_begin = 0;
+        shard_mode = 0;
+        shard_count = 1;
+        shards.clear();
+        sums.Resize(w, h);
+        sums.Fill(Color::zero);
+        variance.Resize(w, h);
+        variance.Fill(PixelVariance());
+    }
+
+    // Same frame of the same scene split the same way, so the samples of both can be combined
+    bool Compatible(const FrameState& other) const {
+        return width() == other.width() && height() == other.height() && seed == other.seed &&
+            scene_hash == other.scene_hash && shard_mode == other.shard_mode && shard_count == other.shard_count;
+    }
+
+    bool HoldsShard(uint32_t index) const {
+        return std::binary_search(shards.begin(), shards.end(), index);
+    }
+
+    int MaxSamples() const {
+        int samples = 0;
+        for (const auto& pixel : variance.data()) {
+            samples = std::max(samples, pixel.count);
+        }
+        return samples;
+    }
+
+    long long TotalSamples() const {
+        long long samples = 0;
+        for (const auto& pixel : variance.data()) {
+            samples += pixel.count;
+        }
+        return samples;
+    }
+
+    // Tone maps the mean of every pixel into image, which is flipped vertically
+    void Resolve(FrameBuffer& image) const {
+        for (int j = 0; j < height(); ++j) {
+            for (int i = 0; i < width(); ++i) {
+                int x = j * width() + i;
+                int count = variance.data()[x].count;
+                image.Set(i, (height() - 1) - j, count > 0 ? SdrColor(sums.data()[x], 1.0 / count) : math::Vec3<uint8_t>(0, 0, 0));
+            }
+        }
+    }
+
+    // Adds the samples of other, false if it holds a shard this state already holds: the
+    // same state twice, or a checkpoint next to its finished shard, would count samples twice
+    bool Merge(const FrameState& other) {
+        if (!Compatible(other)) {
+            std::cerr << "Cannot merge the samples of a different frame or split" << std::endl;
+            return false;
+        }
+        for (uint32_t index : other.shards) {
+            if (HoldsShard(index)) {
+                std::cerr << "Shard " << index << " of " << shard_count << " is merged twice" << std::endl;
+                return false;
+            }
+        }
+
+        shards.insert(shards.end(), other.shards.begin(), other.shards.end());
+        std::sort(shards.begin(), shards.end());
+        // Every shard of a split is the whole frame, which renders with the tile mode (0)
+        if (shard_count > 1 && shards.size() == shard_count) {
+            shard_mode = 0;
+            shard_count = 1;
+            shards.assign(1, 0);
+        }
+
+        sample_begin = std::min(sample_begin, other.sample_begin);
+        for (size_t i = 0; i < sums.size(); ++i) {
+            sums.data()[i] += other.sums.data()[i];
+            variance.data()[i].Merge(other.variance.data()[i]);
+        }
+        return true;
+    }
+
+    // Written to a temporary file first, an interrupted save keeps the previous checkpoint
+    bool Save(const std::string& path) const;
+    bool Load(const std::string& path);
+
+    uint64_t seed = 0;
+    uint64_t scene_hash = 0;
+    // Index of the first sample the counts start from
+    int sample_begin = 0;
+    // ShardMode the frame is split by, shards of a tile split and a sample split overlap
+    uint32_t shard_mode = 0;
+    // Shards of the split this state holds, sorted. A whole frame is shard 0 of 1.
+    uint32_t shard_count = 1;
+    std::vector<uint32_t> shards;
+    AccumulationBuffer sums;
+    Buffer<PixelVariance> variance;
+
+private:
+    template<typename T>
+    static void Write(std::ostream& out, T value) {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    template<typename T>
+    static bool Read(std::istream& in, T& value) {
+        return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(value)));
+    }
+};
+
+inline bool FrameState::Save(const std::string& path) const {
+    std::string temp_path = path + ".tmp";
+    {
+        std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            std::cerr << "Cannot write checkpoint " << temp_path << std::endl;
+            return false;
+        }
+
+        Write<uint32_t>(out, kMagic);
+        Write<uint32_t>(out, kVersion);
+        Write<uint32_t>(out, static_cast<uint32_t>(width()));
+        Write<uint32_t>(out, static_cast<uint32_t>(height()));
+        Write<uint64_t>(out, seed);
+        Write<uint64_t>(out, scene_hash);
+        Write<uint32_t>(out, static_cast<uint32_t>(sample_begin));
+        Write<uint32_t>(out, shard_mode);
+        Write<uint32_t>(out, shard_count);
+        Write<uint32_t>(out, static_cast<uint32_t>(shards.size()));
+        for (uint32_t index : shards) {
+            Write<uint32_t>(out, index);
+        }
+
+        for (size_t i = 0; i < sums.size(); ++i) {
+            const Color& sum = sums.data()[i];
+            const PixelVariance& pixel = variance.data()[i];
+            Write<double>(out, sum.r);
+            Write<double>(out, sum.g);
+            Write<double>(out, sum.b);
+            Write<int32_t>(out, pixel.count);
+            Write<double>(out, pixel.mean);
+            Write<double>(out, pixel.m2);
+        }
+
+        if (!out.flush()) {
+            std::cerr << "Cannot write checkpoint " << temp_path << std::endl;
+            return false;
+        }
+    }
+
+    if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+        std::cerr << "Cannot replace checkpoint " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+inline bool FrameState::Load(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        return false;
+    }
+
+    uint32_t magic, version, w, h, begin, mode, count, held;
+    uint64_t file_seed, file_hash;
+    if (!Read(in, magic) || !Read(in, version) || magic != kMagic || version != kVersion) {
+        std::cerr << path << " is not a checkpoint of this version" << std::endl;
+        return false;
+    }
+    if (!Read(in, w) || !Read(in, h) || !Read(in, file_seed) || !Read(in, file_hash) || !Read(in, begin) || !Read(in, mode) ||
+        !Read(in, count) || !Read(in, held)) {
+        std::cerr << "Truncated checkpoint " << path << std::endl;
+        return false;
+    }
+
+    if (count == 0 || held > count) {
+        std::cerr << "Invalid shards in checkpoint " << path << std::endl;
+        return false;
+    }
+
+    std::vector<uint32_t> file_shards(held);
+    for (uint32_t i = 0; i < held; ++i) {
+        if (!Read(in, file_shards[i])) {
+            std::cerr << "Truncated checkpoint " << path << std::endl;
+            return false;
+        }
+        if (file_shards[i] >= count || (i > 0 && file_shards[i] <= file_shards[i - 1])) {
+            std::cerr << "Invalid shards in checkpoint " << path << std::endl;
+            return false;
+        }
+    }
+
+    // The pixels must fill the rest of the file exactly, a corrupt header never sizes the buffers
+    std::streamoff pixels_begin = in.tellg();
+    in.seekg(0, std::ios::end);
+    std::streamoff remaining = in.tellg() - pixels_begin;
+    in.seekg(pixels_begin);
+    if (w == 0 || h == 0 || w > static_cast<uint32_t>(std::numeric_limits<int>::max()) ||
+        h > static_cast<uint32_t>(std::numeric_limits<int>::max()) || remaining < 0 ||
+        static_cast<uint64_t>(remaining) % kPixelBytes != 0 ||
+        static_cast<uint64_t>(remaining) / kPixelBytes != static_cast<uint64_t>(w) * h) {
+        std::cerr << "Size of checkpoint " << path << " does not match its " << w << "x" << h << " pixels" << std::endl;
+        return false;
+    }
+
+    Reset(static_cast<int>(w), static_cast<int>(h), file_seed, file_hash);
+    sample_begin = static_cast<int>(begin);
+    shard_mode = mode;
+    shard_count = count;
+    shards.swap(file_shards);
+    for (size_t i = 0; i < sums.size(); ++i) {
+        Color& sum = sums.data()[i];
+        PixelVariance& pixel = variance.data()[i];
+        int32_t count;
+        if (!Read(in, sum.r) || !Read(in, sum.g) || !Read(in, sum.b) ||
+            !Read(in, count) || !Read(in, pixel.mean) || !Read(in, pixel.m2)) {
+            std::cerr << "Truncated checkpoint " << path << std::endl;
+            return false;
+        }
+        pixel.count = count;
+    }
+    if (in.peek() != std::char_traits<char>::eof()) {
+        std::cerr << "Trailing data in checkpoint " << path << std::endl;
+        return false;
+    }
+    return true;
+}
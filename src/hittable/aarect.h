@@ -41,26 +41,44 @@ public:
     };
 
     virtual bool Hit(const Ray& r, XFloat t0, XFloat t1, HitResult& rec) const override;
+    virtual bool Occluded(const Ray& r, XFloat t0, XFloat t1) const override;
     virtual XFloat PDF(const Vec3f& origin, const Vec3f& v) const override;
-    virtual Vec3f Sample(const Vec3f& origin) const override;
+    virtual XFloat PDF(const Vec3f& origin, const Vec3f& v, const HitResult& rec) const override;
+    virtual Vec3f Sample(const Vec3f& origin, math::Rand& rng) const override;
+    virtual XFloat Area() const override { return (x1 - x0) * (y1 - y0); }
+    virtual void NormalBounds(Vec3f& w, XFloat& cos_theta) const override {
+        w = Vec3f::zero;
+        w[ik] = face_positive ? 1 : -1;
+        cos_theta = 1;
+    }
 
 public:
     int ix, iy, ik;
     XFloat x0, x1;
     XFloat y0, y1;
     XFloat k;
+
+private:
+    // Distance along r to the plane of the rectangle, if the ray crosses the rectangle within [t0, t1]
+    bool Intersect(const Ray& r, XFloat t0, XFloat t1, XFloat& t) const {
+        t = (k - r.origin[ik]) / r.direction[ik];
+        if (t < t0 || t > t1)
+            return false;
+
+        auto x = r.origin[ix] + t*r.direction[ix];
+        auto y = r.origin[iy] + t*r.direction[iy];
+        return x >= x0 && x <= x1 && y >= y0 && y <= y1;
+    }
 };
 
 template<math::Axis axis, bool face_positive>
 bool AARect<axis, face_positive>::Hit(const Ray& r, XFloat t0, XFloat t1, HitResult& rec) const {
-    auto t = (k - r.origin[ik]) / r.direction[ik];
-    if (t < t0 || t > t1)
+    XFloat t;
+    if (!Intersect(r, t0, t1, t))
         return false;
 
     auto x = r.origin[ix] + t*r.direction[ix];
     auto y = r.origin[iy] + t*r.direction[iy];
-    if (x < x0 || x > x1 || y < y0 || y > y1)
-        return false;
 
     rec.uv.u = (x-x0)/(x1-x0);
     rec.uv.v = (y-y0)/(y1-y0);
@@ -75,23 +93,35 @@ bool AARect<axis, face_positive>::Hit(const Ray& r, XFloat t0, XFloat t1, HitRes
     return true;
 }
 
+template<math::Axis axis, bool face_positive>
+bool AARect<axis, face_positive>::Occluded(const Ray& r, XFloat t0, XFloat t1) const {
+    XFloat t;
+    return Intersect(r, t0, t1, t);
+}
+
 template<math::Axis axis, bool face_positive>
 XFloat AARect<axis, face_positive>::PDF(const Vec3f& origin, const Vec3f& wo) const {
     HitResult rec;
-    if (!Hit(Ray(origin, wo), 0.001, math::kInfinite, rec))
+    if (!Intersect(Ray(origin, wo), 0.001, math::kInfinite, rec.t))
         return 0;
 
+    return PDF(origin, wo, rec);
+}
+
+template<math::Axis axis, bool face_positive>
+XFloat AARect<axis, face_positive>::PDF(const Vec3f&, const Vec3f& wo, const HitResult& rec) const {
     auto area = (x1-x0) * (y1-y0);
     auto distance_squared = rec.t * rec.t * wo.MagnitudeSq();
-    auto cosine = fabs(wo.Normalize().Dot(rec.normal));
+    // The normal is the axis of the rectangle
+    auto cosine = fabs(wo[ik]) / wo.Magnitude();
 
     return distance_squared / (cosine * area);
 }
 
 template<math::Axis axis, bool face_positive>
-Vec3f AARect<axis, face_positive>::Sample(const Vec3f& origin) const {
-    XFloat r1 = math::random::Random(x0,x1);
-    XFloat r2 = math::random::Random(y0,y1);
+Vec3f AARect<axis, face_positive>::Sample(const Vec3f& origin, math::Rand& rng) const {
+    XFloat r1 = math::random::Random(rng, x0, x1);
+    XFloat r2 = math::random::Random(rng, y0, y1);
     auto random_point = Vec3f(k);
 
     if (axis == math::Axis::kX) {
@@ -15,6 +15,7 @@ public:
     }
 
     virtual bool Hit(const Ray& r, XFloat tmin, XFloat tmax, HitResult& rec) const override;
+    virtual bool Occluded(const Ray& r, XFloat tmin, XFloat tmax) const override;
 
     Vec3f extent;
     Transform transform;
@@ -66,3 +67,11 @@ bool Box::Hit(const Ray& r, XFloat tmin, XFloat tmax, HitResult& rec) const {
 
     return true;
 }
+
+bool Box::Occluded(const Ray& r, XFloat tmin, XFloat tmax) const {
+    AABB aabb(Vec3f(-extent.x, -extent.y, -extent.z), extent);
+    Ray local_ray(transform.InverseTransform(r.origin), transform.InverseTransformVector(r.direction));
+
+    XFloat t;
+    return aabb.Hit(local_ray, tmin, tmax, &t);
+}
@@ -1,54 +1,73 @@
 #include "bvh.h"
+#include <chrono>
+#include "concurrent/task_group.h"
 
-BvhNode::BvhNode(const std::vector<std::shared_ptr<Hittable>>& src_objects, size_t start, size_t end) {
-    std::vector<std::shared_ptr<Hittable>> objects = src_objects; // Create a modifiable array of the source scene objects
-    size_t object_span = end - start;
-    int axis = math::random::Random(0, 2);
-
-    if (object_span == 1) {
-        left_ = objects[start];
-        left_->BuildBVH();
-    } else if (object_span == 2) {
-        if (objects[start]->bounding_box().Compare(objects[start+1]->bounding_box(), axis)) {
-            left_ = objects[start];
-            right_ = objects[start+1];
-        } else {
-            left_ = objects[start+1];
-            right_ = objects[start];
+Bvh::Bvh(const std::vector<std::shared_ptr<Hittable>>& objects, const BvhOptions& options, ThreadPool* pool) {
+    if (objects.empty()) return;
+
+    auto begin = std::chrono::steady_clock::now();
+
+    // Nested BVHs (meshes, lists) are independent of each other, build them in chunks
+    constexpr size_t kChunkSize = 256;
+    std::vector<BvhPrimitive> refs(objects.size());
+    {
+        TaskGroup group(pool);
+        for (size_t chunk = 0; chunk < objects.size(); chunk += kChunkSize) {
+            group.Run([&, chunk] {
+                size_t chunk_end = std::min(chunk + kChunkSize, objects.size());
+                for (size_t i = chunk; i < chunk_end; ++i) {
+                    objects[i]->BuildBVH(options, pool);
+
+                    const AABB& box = objects[i]->bounding_box();
+                    refs[i].bounds = box;
+                    refs[i].centroid = (box.min + box.max) * 0.5;
+                    refs[i].index = static_cast<uint32_t>(i);
+                }
+            });
         }
-        left_->BuildBVH();
-        right_->BuildBVH();
-    } else {
-        std::sort(objects.begin() + start, objects.begin() + end, [axis](const std::shared_ptr<Hittable> a, const std::shared_ptr<Hittable> b){
-            return a->bounding_box().Compare(b->bounding_box(), axis);
-        });
-
-        auto mid = start + object_span / 2;
-        left_ = std::make_shared<BvhNode>(objects, start, mid);
-        right_ = std::make_shared<BvhNode>(objects, mid, end);
+        group.Wait();
     }
 
-    if (right_) {
-        bounding_box_ = AABB::Union(left_->bounding_box(), right_->bounding_box());
-    } else {
-        bounding_box_ = left_->bounding_box();
+    bounding_box_ = refs[0].bounds;
+    for (size_t i = 1; i < refs.size(); ++i) {
+        bounding_box_ = AABB::Union(bounding_box_, refs[i].bounds);
     }
-}
 
-bool BvhNode::Hit(const Ray& r, XFloat t_min, XFloat t_max, HitResult& rec) const {
-    if (!bounding_box_.Hit(r, t_min, t_max))
-        return false;
+    tree_.Build(refs, options, pool);
 
-    bool hit_left = left_->Hit(r, t_min, t_max, rec);
-    bool hit_right = right_ ? right_->Hit(r, t_min, hit_left ? rec.t : t_max, rec) : false;
+    // Leaves address contiguous ranges, so the objects are reordered once at the end
+    objects_.reserve(refs.size());
+    for (const auto& ref : refs) {
+        objects_.push_back(objects[ref.index]);
+    }
 
-    return hit_left || hit_right;
+    std::chrono::duration<double> diff = std::chrono::steady_clock::now() - begin;
+    build_time_ = diff.count();
 }
 
-void BvhNode::FetchLight(std::vector<std::shared_ptr<Hittable>>& lights) {
-    left_->FetchLight(lights);
-    if (right_) {
-        right_->FetchLight(lights);
-    }
+bool Bvh::Hit(const Ray& r, XFloat t_min, XFloat t_max, HitResult& rec) const {
+    return tree_.Traverse(r, t_min, t_max, [&](uint32_t i, XFloat t0, XFloat& t1) {
+        if (!objects_[i]->Hit(r, t0, t1, rec)) {
+            return false;
+        }
+        t1 = rec.t;
+        return true;
+    });
 }
 
+bool Bvh::Occluded(const Ray& r, XFloat t_min, XFloat t_max) const {
+    return tree_.TraverseAny(r, t_min, t_max, [&](uint32_t offset, uint32_t count, XFloat t0, XFloat t1) {
+        for (uint32_t i = offset; i < offset + count; ++i) {
+            if (objects_[i]->Occluded(r, t0, t1)) {
+                return true;
+            }
+        }
+        return false;
+    });
+}
+
+void Bvh::FetchLight(std::vector<std::shared_ptr<Hittable>>& lights) {
+    for (auto& object : objects_) {
+        object->FetchLight(lights);
+    }
+}
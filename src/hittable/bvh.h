@@ -2,18 +2,27 @@
 
 #include <algorithm>
 #include "hittable.h"
+#include "bvh_tree.h"
 #include "mesh.h"
 #include "math/random.h"
 
-class BvhNode : public Hittable  {
+// Bvh over scene objects
+class Bvh : public Hittable  {
 public:
-    BvhNode(const std::vector<std::shared_ptr<Hittable>>& src_objects, size_t start, size_t end);
+    // With a pool, nested BVHs and large subtrees are built concurrently.
+    // The resulting tree is the same as a serial build.
+    Bvh(const std::vector<std::shared_ptr<Hittable>>& objects, const BvhOptions& options = BvhOptions(), ThreadPool* pool = nullptr);
+
+    XFloat build_time() const { return build_time_; }
 
     virtual bool Hit(const Ray& r, XFloat t_min, XFloat t_max, HitResult& rec) const override;
+    virtual bool Occluded(const Ray& r, XFloat t_min, XFloat t_max) const override;
     virtual void FetchLight(std::vector<std::shared_ptr<Hittable>>& lights) override;
 
+    BvhStats Stats() const { return tree_.Stats(); }
+
 private:
-    std::shared_ptr<Hittable> left_;
-    std::shared_ptr<Hittable> right_;
+    std::vector<std::shared_ptr<Hittable>> objects_;
+    BvhTree tree_;
+    XFloat build_time_ = 0;
 };
-
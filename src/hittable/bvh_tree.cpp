@@ -0,0 +1,342 @@
+#include "bvh_tree.h"
+#include <chrono>
+#include <cmath>
+#include "concurrent/task_group.h"
+
+namespace {
+
+constexpr int kBinCount = 12;
+
+struct SahBin {
+    AABB bounds;
+    int count = 0;
+};
+
+inline float RoundDown(XFloat v) {
+    float f = static_cast<float>(v);
+    return f > v ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+}
+
+inline float RoundUp(XFloat v) {
+    float f = static_cast<float>(v);
+    return f < v ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+}
+
+inline XFloat NodeArea(const LinearBvhNode& node) {
+    XFloat a = node.max[0] - node.min[0];
+    XFloat b = node.max[1] - node.min[1];
+    XFloat c = node.max[2] - node.min[2];
+    return 2 * (a*b + b*c + c*a);
+}
+
+inline void ToLinearBounds(const AABB& box, LinearBvhNode& node) {
+    for (int i = 0; i < 3; ++i) {
+        node.min[i] = RoundDown(box.min[i]);
+        node.max[i] = RoundUp(box.max[i]);
+    }
+}
+
+// Intersection cost of a leaf, in units of kIntersectionCost
+inline int LeafCost(size_t count, int packet_size) {
+    return static_cast<int>((count + packet_size - 1) / packet_size);
+}
+
+inline int BinIndex(const Vec3f& centroid, const AABB& centroid_bounds, int axis) {
+    auto extent = centroid_bounds.max[axis] - centroid_bounds.min[axis];
+    int b = static_cast<int>(kBinCount * (centroid[axis] - centroid_bounds.min[axis]) / extent);
+    return math::Clamp(b, 0, kBinCount - 1);
+}
+
+size_t SplitMiddle(std::vector<BvhPrimitive>& refs, size_t start, size_t end, int axis) {
+    auto mid = start + (end - start) / 2;
+    std::nth_element(refs.begin() + start, refs.begin() + mid, refs.begin() + end,
+        [axis](const BvhPrimitive& a, const BvhPrimitive& b) {
+            return a.centroid[axis] < b.centroid[axis];
+        });
+    return mid;
+}
+
+// Binned SAH, see Wald, On fast Construction of SAH-based Bounding Volume Hierarchies
+// http://www.sci.utah.edu/~wald/Publications/2007/ParallelBVHBuild/fastbuild.pdf
+// Returns the last bin of the left side, or -1 if no plane separates the primitives.
+// cost is the sum of area times leaf cost of both sides.
+int FindSplitSAH(const std::vector<BvhPrimitive>& refs, size_t start, size_t end, int axis, const AABB& centroid_bounds, int packet_size, XFloat& cost) {
+    if (centroid_bounds.max[axis] - centroid_bounds.min[axis] < math::kEpsilon) {
+        return -1;
+    }
+
+    SahBin bins[kBinCount];
+    for (size_t i = start; i < end; ++i) {
+        auto& bin = bins[BinIndex(refs[i].centroid, centroid_bounds, axis)];
+        bin.bounds = bin.count == 0 ? refs[i].bounds : AABB::Union(bin.bounds, refs[i].bounds);
+        ++bin.count;
+    }
+
+    // Sweep from the right to get the area and count of every right side
+    XFloat right_area[kBinCount - 1];
+    int right_count[kBinCount - 1];
+    AABB acc;
+    int count = 0;
+    for (int i = kBinCount - 1; i > 0; --i) {
+        if (bins[i].count > 0) {
+            acc = count == 0 ? bins[i].bounds : AABB::Union(acc, bins[i].bounds);
+            count += bins[i].count;
+        }
+        right_area[i - 1] = count > 0 ? acc.Area() : 0;
+        right_count[i - 1] = count;
+    }
+
+    int best = -1;
+    cost = math::kInfinite;
+    count = 0;
+    for (int i = 0; i < kBinCount - 1; ++i) {
+        if (bins[i].count > 0) {
+            acc = count == 0 ? bins[i].bounds : AABB::Union(acc, bins[i].bounds);
+            count += bins[i].count;
+        }
+
+        if (count == 0 || right_count[i] == 0) continue;
+
+        XFloat c = acc.Area() * LeafCost(count, packet_size) + right_area[i] * LeafCost(right_count[i], packet_size);
+        if (c < cost) {
+            cost = c;
+            best = i;
+        }
+    }
+
+    return best;
+}
+
+}
+
+void BvhTree::Build(std::vector<BvhPrimitive>& refs, const BvhOptions& options, ThreadPool* pool, int packet_size) {
+    nodes_.clear();
+    wide_nodes_.clear();
+    packet_size_ = packet_size;
+    if (refs.empty()) return;
+
+    auto begin = std::chrono::steady_clock::now();
+
+    // A binary tree over n leaves has at most 2n - 1 nodes
+    nodes_.reserve(2 * refs.size() - 1);
+    BuildSpec spec = { options.split, packet_size, pool };
+    Build(refs, 0, refs.size(), spec, 0, nodes_);
+
+    if (options.layout == BvhLayout::kWide) {
+        // Collapsing removes at least every other level
+        wide_nodes_.reserve(nodes_.size() / 2 + 1);
+        Collapse(0);
+        wide_nodes_.shrink_to_fit();
+        std::vector<LinearBvhNode>().swap(nodes_);
+    } else {
+        nodes_.shrink_to_fit();
+    }
+
+    std::chrono::duration<double> diff = std::chrono::steady_clock::now() - begin;
+    build_time_ = diff.count();
+}
+
+// Nodes are emitted in depth-first order directly into nodes, the first child
+// of an interior node lands right after it
+void BvhTree::Build(std::vector<BvhPrimitive>& refs, size_t start, size_t end, const BuildSpec& spec, int depth,
+    std::vector<LinearBvhNode>& nodes)
+{
+    size_t count = end - start;
+
+    AABB bounds = refs[start].bounds;
+    AABB centroid_bounds(refs[start].centroid, refs[start].centroid);
+    for (size_t i = start + 1; i < end; ++i) {
+        bounds = AABB::Union(bounds, refs[i].bounds);
+        centroid_bounds = AABB::Union(centroid_bounds, AABB(refs[i].centroid, refs[i].centroid));
+    }
+
+    int axis = centroid_bounds.LongestAxis();
+
+    size_t mid = start;
+    if (count > 1) {
+        XFloat cost;
+        int bin = -1;
+        // Deep in a degenerate tree fall back to median splits, which bound the depth of the traversal stack
+        if (spec.split == BvhSplit::kSAH && depth < kMaxDepth / 2) {
+            bin = FindSplitSAH(refs, start, end, axis, centroid_bounds, spec.packet_size, cost);
+        }
+
+        if (bin >= 0) {
+            XFloat split_cost = kTraversalCost + kIntersectionCost * cost / bounds.Area();
+            XFloat leaf_cost = kIntersectionCost * LeafCost(count, spec.packet_size);
+            if (count > kMaxLeafSize || split_cost < leaf_cost) {
+                auto it = std::partition(refs.begin() + start, refs.begin() + end,
+                    [&](const BvhPrimitive& ref) {
+                        return BinIndex(ref.centroid, centroid_bounds, axis) <= bin;
+                    });
+                mid = it - refs.begin();
+            }
+        } else if (count > kMaxLeafSize) {
+            mid = SplitMiddle(refs, start, end, axis);
+        }
+    }
+
+    size_t offset = nodes.size();
+    nodes.emplace_back();
+    ToLinearBounds(bounds, nodes[offset]);
+    nodes[offset].axis = static_cast<uint8_t>(axis);
+    nodes[offset].pad = 0;
+
+    if (mid == start) {
+        nodes[offset].primitives_offset = static_cast<uint32_t>(start);
+        nodes[offset].primitive_count = static_cast<uint16_t>(count);
+        return;
+    }
+
+    nodes[offset].primitive_count = 0;
+
+    if (!spec.pool || count < kParallelBuildThreshold) {
+        Build(refs, start, mid, spec, depth + 1, nodes);
+        nodes[offset].second_child_offset = static_cast<uint32_t>(nodes.size());
+        Build(refs, mid, end, spec, depth + 1, nodes);
+        return;
+    }
+
+    // Both halves own disjoint ranges of refs. The right one is built into its own array
+    // and spliced after the left one, which keeps the layout of a serial build.
+    std::vector<LinearBvhNode> right;
+    {
+        TaskGroup group(spec.pool);
+        group.Run([&] {
+            right.reserve(2 * (end - mid) - 1);
+            Build(refs, mid, end, spec, depth + 1, right);
+        });
+        Build(refs, start, mid, spec, depth + 1, nodes);
+        group.Wait();
+    }
+
+    uint32_t base = static_cast<uint32_t>(nodes.size());
+    nodes[offset].second_child_offset = base;
+    for (auto node : right) {
+        if (node.primitive_count == 0) {
+            node.second_child_offset += base;
+        }
+        nodes.push_back(node);
+    }
+}
+
+// Pulls the children of the binary node at index into one wide node, opening the
+// largest inner child until the four lanes are used. Returns the wide node index.
+uint32_t BvhTree::Collapse(uint32_t index) {
+    uint32_t lanes[WideBvhNode::kWidth] = { index };
+    int count = 1;
+    while (count < WideBvhNode::kWidth) {
+        int best = -1;
+        XFloat best_area = -1;
+        for (int i = 0; i < count; ++i) {
+            const auto& node = nodes_[lanes[i]];
+            if (node.primitive_count == 0 && NodeArea(node) > best_area) {
+                best_area = NodeArea(node);
+                best = i;
+            }
+        }
+
+        if (best < 0) break;
+
+        uint32_t opened = lanes[best];
+        lanes[best] = opened + 1;
+        lanes[count++] = nodes_[opened].second_child_offset;
+    }
+
+    uint32_t offset = static_cast<uint32_t>(wide_nodes_.size());
+    wide_nodes_.emplace_back();
+
+    WideBvhNode wide;
+    for (int lane = 0; lane < WideBvhNode::kWidth; ++lane) {
+        if (lane >= count) {
+            for (int i = 0; i < 3; ++i) {
+                wide.min[i][lane] = std::numeric_limits<float>::infinity();
+                wide.max[i][lane] = -std::numeric_limits<float>::infinity();
+            }
+            wide.child[lane] = WideBvhNode::kEmpty;
+            wide.count[lane] = 0;
+            continue;
+        }
+
+        const auto& node = nodes_[lanes[lane]];
+        for (int i = 0; i < 3; ++i) {
+            wide.min[i][lane] = node.min[i];
+            wide.max[i][lane] = node.max[i];
+        }
+
+        if (node.primitive_count > 0) {
+            wide.child[lane] = node.primitives_offset;
+            wide.count[lane] = node.primitive_count;
+        } else {
+            wide.child[lane] = Collapse(lanes[lane]);
+            wide.count[lane] = 0;
+        }
+    }
+    for (auto& p : wide.pad) {
+        p = 0;
+    }
+
+    wide_nodes_[offset] = wide;
+    return offset;
+}
+
+// SAH cost of the whole tree: every node pays a traversal and every primitive an intersection,
+// weighted by the probability that a ray hitting the root also hits the box being tested
+BvhStats BvhTree::Stats() const {
+    BvhStats stats;
+    if (!wide_nodes_.empty()) {
+        return WideStats();
+    }
+    if (nodes_.empty()) return stats;
+
+    auto root_area = NodeArea(nodes_[0]);
+    auto inv_root_area = root_area > 0 ? 1.0 / root_area : 0.0;
+
+    stats.nodes = static_cast<int>(nodes_.size());
+    for (const auto& node : nodes_) {
+        auto probability = NodeArea(node) * inv_root_area;
+        if (node.primitive_count > 0) {
+            stats.leaves += 1;
+            stats.sah_cost += kIntersectionCost * LeafCost(node.primitive_count, packet_size_) * probability;
+        } else {
+            stats.sah_cost += kTraversalCost * probability;
+        }
+    }
+
+    return stats;
+}
+
+// A wide node pays one traversal for its four boxes
+BvhStats BvhTree::WideStats() const {
+    BvhStats stats;
+    stats.nodes = static_cast<int>(wide_nodes_.size());
+
+    auto node_box = [](const WideBvhNode& node) {
+        AABB box(Vec3f(math::kInfinite), Vec3f(-math::kInfinite));
+        for (int lane = 0; lane < WideBvhNode::kWidth; ++lane) {
+            if (node.child[lane] == WideBvhNode::kEmpty) continue;
+            for (int i = 0; i < 3; ++i) {
+                box.min[i] = math::Min<XFloat>(box.min[i], node.min[i][lane]);
+                box.max[i] = math::Max<XFloat>(box.max[i], node.max[i][lane]);
+            }
+        }
+        return box;
+    };
+
+    auto root_area = node_box(wide_nodes_[0]).Area();
+    auto inv_root_area = root_area > 0 ? 1.0 / root_area : 0.0;
+
+    for (const auto& node : wide_nodes_) {
+        stats.sah_cost += kTraversalCost * node_box(node).Area() * inv_root_area;
+        for (int lane = 0; lane < WideBvhNode::kWidth; ++lane) {
+            if (node.count[lane] == 0) continue;
+
+            AABB box(Vec3f(node.min[0][lane], node.min[1][lane], node.min[2][lane]),
+                Vec3f(node.max[0][lane], node.max[1][lane], node.max[2][lane]));
+            stats.leaves += 1;
+            stats.sah_cost += kIntersectionCost * LeafCost(node.count[lane], packet_size_) * box.Area() * inv_root_area;
+        }
+    }
+
+    return stats;
+}
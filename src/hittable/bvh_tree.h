@@ -0,0 +1,298 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <vector>
+#include "hittable.h"
+#include "common/aabb.h"
+#include "common/ray.h"
+#include "math/simd.h"
+
+struct BvhStats {
+    int nodes = 0;
+    int leaves = 0;
+    XFloat sah_cost = 0;
+};
+
+inline std::ostream& operator<<(std::ostream& os, const BvhStats& stats) {
+    return os << "nodes: " << stats.nodes << ", leaves: " << stats.leaves << ", SAH cost: " << stats.sah_cost;
+}
+
+// Node of the depth-first flattened tree. The first child of an interior node
+// is stored right after it, so only the offset of the second child is kept.
+// Bounds are rounded outwards to float to fit the node in 32 bytes.
+struct LinearBvhNode {
+    float min[3];
+    float max[3];
+    union {
+        uint32_t primitives_offset;   // leaf
+        uint32_t second_child_offset; // interior
+    };
+    uint16_t primitive_count; // 0 for interior nodes
+    uint8_t axis;             // split axis of interior nodes
+    uint8_t pad;
+
+    bool Hit(const Ray& r, XFloat t_min, XFloat t_max) const {
+        for (int i = 0; i < 3; ++i) {
+            XFloat t0 = ((r.dir_is_neg[i] ? max[i] : min[i]) - r.origin[i]) * r.inv_direction[i];
+            XFloat t1 = ((r.dir_is_neg[i] ? min[i] : max[i]) - r.origin[i]) * r.inv_direction[i];
+            t_min = std::max(t_min, t0);
+            t_max = std::min(t_max, t1);
+        }
+        return t_min <= t_max;
+    }
+};
+
+static_assert(sizeof(LinearBvhNode) == 32, "LinearBvhNode should be 32 bytes");
+
+// Four children of a collapsed binary tree, bounds stored lane by lane so all
+// four boxes are tested at once. Empty lanes have inverted bounds and never hit.
+struct alignas(16) WideBvhNode {
+    static constexpr int kWidth = 4;
+    static constexpr uint32_t kEmpty = 0xffffffff;
+
+    float min[3][kWidth];
+    float max[3][kWidth];
+    uint32_t child[kWidth]; // wide node index, or primitives offset of a leaf child
+    uint16_t count[kWidth]; // primitive count of a leaf child, 0 for an inner child
+    uint8_t pad[8];
+
+    // Returns the mask of lanes hit within [t_min, t_max] and their entry distances
+    int Hit(const float origin[3], const float inv_dir[3], const int dir_is_neg[3], float t_min, float t_max, float t_near[kWidth]) const {
+        // Float slabs are widened a little so that rounding the ray never drops a grazing hit
+        constexpr float kRobustScale = 1.0f + 2.0f * 3.0f * std::numeric_limits<float>::epsilon();
+#ifdef RAYTOY_SSE
+        __m128 lo = _mm_set1_ps(t_min);
+        __m128 hi = _mm_set1_ps(t_max);
+        for (int i = 0; i < 3; ++i) {
+            const __m128 o = _mm_set1_ps(origin[i]);
+            const __m128 inv = _mm_set1_ps(inv_dir[i]);
+            const __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(dir_is_neg[i] ? max[i] : min[i]), o), inv);
+            const __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(dir_is_neg[i] ? min[i] : max[i]), o), inv);
+            // NaN slabs (ray origin on a plane of a flat box) keep the running interval
+            lo = _mm_max_ps(t0, lo);
+            hi = _mm_min_ps(_mm_mul_ps(t1, _mm_set1_ps(kRobustScale)), hi);
+        }
+        _mm_store_ps(t_near, lo);
+        return _mm_movemask_ps(_mm_cmple_ps(lo, hi));
+#else
+        int mask = 0;
+        for (int lane = 0; lane < kWidth; ++lane) {
+            float lo = t_min;
+            float hi = t_max;
+            for (int i = 0; i < 3; ++i) {
+                float t0 = ((dir_is_neg[i] ? max[i][lane] : min[i][lane]) - origin[i]) * inv_dir[i];
+                float t1 = ((dir_is_neg[i] ? min[i][lane] : max[i][lane]) - origin[i]) * inv_dir[i] * kRobustScale;
+                lo = std::max(lo, t0);
+                hi = std::min(hi, t1);
+            }
+            t_near[lane] = lo;
+            if (lo <= hi) mask |= 1 << lane;
+        }
+        return mask;
+#endif
+    }
+};
+
+static_assert(sizeof(WideBvhNode) == 128, "WideBvhNode should be 128 bytes");
+
+// Build-time reference to a primitive, partitioned in place instead of the primitives themselves
+struct BvhPrimitive {
+    AABB bounds;
+    Vec3f centroid;
+    uint32_t index;
+};
+
+// Primitive agnostic linear BVH. Leaves address ranges of the primitive array
+// as ordered by Build, the owner keeps the primitives and intersects them.
+class BvhTree {
+public:
+    // Costs used by the SAH, relative to one primitive intersection
+    static constexpr XFloat kTraversalCost = 0.125;
+    static constexpr XFloat kIntersectionCost = 1.0;
+    static constexpr int kMaxLeafSize = 4;
+    static constexpr int kMaxDepth = 64;
+    // Subtrees over at least this many primitives are built as separate tasks
+    static constexpr size_t kParallelBuildThreshold = 4096;
+
+    // Reorders refs to the leaf order, owners then reorder their primitives by refs[i].index.
+    // With a pool large subtrees are built concurrently, the tree is the same as a serial build.
+    // packet_size is the number of primitives a leaf intersects at the cost of one, the SAH
+    // then fills leaves up to kMaxLeafSize for packet kernels.
+    void Build(std::vector<BvhPrimitive>& refs, const BvhOptions& options, ThreadPool* pool = nullptr, int packet_size = 1);
+
+    // Lets the owner replace the primitive offset of every leaf with its own payload,
+    // e.g. the index of a packed leaf. remap(offset, count) returns the new offset.
+    template<typename F>
+    void RemapLeaves(F&& remap) {
+        for (auto& node : nodes_) {
+            if (node.primitive_count > 0) {
+                node.primitives_offset = remap(node.primitives_offset, node.primitive_count);
+            }
+        }
+        for (auto& node : wide_nodes_) {
+            for (int lane = 0; lane < WideBvhNode::kWidth; ++lane) {
+                if (node.count[lane] > 0) {
+                    node.child[lane] = remap(node.child[lane], node.count[lane]);
+                }
+            }
+        }
+    }
+
+    bool empty() const { return nodes_.empty() && wide_nodes_.empty(); }
+    const std::vector<LinearBvhNode>& nodes() const { return nodes_; }
+    XFloat build_time() const { return build_time_; }
+
+    BvhStats Stats() const;
+
+    // intersect(index, t_min, t_max) tests the primitive at index of the leaf order,
+    // and on a hit shrinks t_max to it and returns true
+    template<typename F>
+    bool Traverse(const Ray& r, XFloat t_min, XFloat t_max, F&& intersect) const;
+
+    // Same as Traverse with a whole leaf per call: intersect(offset, count, t_min, t_max)
+    template<typename F>
+    bool TraverseLeaves(const Ray& r, XFloat t_min, XFloat t_max, F&& intersect) const;
+
+    // Any hit traversal: stops at the first leaf occluded(offset, count, t_min, t_max)
+    // reports a hit in, the leaves are visited in no particular order
+    template<typename F>
+    bool TraverseAny(const Ray& r, XFloat t_min, XFloat t_max, F&& occluded) const;
+
+private:
+    struct BuildSpec {
+        BvhSplit split;
+        int packet_size;
+        ThreadPool* pool;
+    };
+
+    static void Build(std::vector<BvhPrimitive>& refs, size_t start, size_t end, const BuildSpec& spec, int depth,
+        std::vector<LinearBvhNode>& nodes);
+    uint32_t Collapse(uint32_t index);
+    BvhStats WideStats() const;
+
+    template<bool kAnyHit, typename F>
+    bool TraverseBinary(const Ray& r, XFloat t_min, XFloat t_max, F&& intersect) const;
+    template<bool kAnyHit, typename F>
+    bool TraverseWide(const Ray& r, XFloat t_min, XFloat t_max, F&& intersect) const;
+
+    // Only one layout is kept, the binary nodes are dropped once collapsed
+    std::vector<LinearBvhNode> nodes_;
+    std::vector<WideBvhNode> wide_nodes_;
+    int packet_size_ = 1;
+    XFloat build_time_ = 0;
+};
+
+template<typename F>
+bool BvhTree::Traverse(const Ray& r, XFloat t_min, XFloat t_max, F&& intersect) const {
+    return TraverseLeaves(r, t_min, t_max, [&](uint32_t offset, uint32_t count, XFloat t0, XFloat& t1) {
+        bool hit = false;
+        for (uint32_t i = 0; i < count; ++i) {
+            if (intersect(offset + i, t0, t1)) {
+                hit = true;
+            }
+        }
+        return hit;
+    });
+}
+
+template<typename F>
+bool BvhTree::TraverseLeaves(const Ray& r, XFloat t_min, XFloat t_max, F&& intersect) const {
+    if (!wide_nodes_.empty()) return TraverseWide<false>(r, t_min, t_max, intersect);
+    return TraverseBinary<false>(r, t_min, t_max, intersect);
+}
+
+template<typename F>
+bool BvhTree::TraverseAny(const Ray& r, XFloat t_min, XFloat t_max, F&& occluded) const {
+    if (!wide_nodes_.empty()) return TraverseWide<true>(r, t_min, t_max, occluded);
+    return TraverseBinary<true>(r, t_min, t_max, occluded);
+}
+
+template<bool kAnyHit, typename F>
+bool BvhTree::TraverseBinary(const Ray& r, XFloat t_min, XFloat t_max, F&& intersect) const {
+    if (nodes_.empty()) return false;
+
+    uint32_t stack[kMaxDepth];
+    int top = 0;
+    uint32_t current = 0;
+    bool hit = false;
+
+    while (true) {
+        const LinearBvhNode& node = nodes_[current];
+        if (node.Hit(r, t_min, t_max)) {
+            if (node.primitive_count > 0) {
+                if (intersect(node.primitives_offset, node.primitive_count, t_min, t_max)) {
+                    if (kAnyHit) return true;
+                    hit = true;
+                }
+                if (top == 0) break;
+                current = stack[--top];
+            } else if (r.dir_is_neg[node.axis]) {
+                // Visit the near child first so the far one is culled by the closer hit
+                stack[top++] = current + 1;
+                current = node.second_child_offset;
+            } else {
+                stack[top++] = node.second_child_offset;
+                current = current + 1;
+            }
+        } else {
+            if (top == 0) break;
+            current = stack[--top];
+        }
+    }
+
+    return hit;
+}
+
+template<bool kAnyHit, typename F>
+bool BvhTree::TraverseWide(const Ray& r, XFloat t_min, XFloat t_max, F&& intersect) const {
+    struct Entry {
+        uint32_t child;
+        uint32_t count;
+        float t_near;
+    };
+
+    const float origin[3] = { static_cast<float>(r.origin.x), static_cast<float>(r.origin.y), static_cast<float>(r.origin.z) };
+    const float inv_dir[3] = { static_cast<float>(r.inv_direction.x), static_cast<float>(r.inv_direction.y), static_cast<float>(r.inv_direction.z) };
+
+    // Every wide level leaves at most three siblings behind
+    Entry stack[3 * kMaxDepth + WideBvhNode::kWidth];
+    int top = 0;
+    stack[top++] = { 0, 0, static_cast<float>(t_min) };
+    bool hit = false;
+
+    while (top > 0) {
+        Entry entry = stack[--top];
+        if (entry.t_near > t_max) continue;
+
+        if (entry.count > 0) {
+            if (intersect(entry.child, entry.count, t_min, t_max)) {
+                if (kAnyHit) return true;
+                hit = true;
+            }
+            continue;
+        }
+
+        const WideBvhNode& node = wide_nodes_[entry.child];
+        alignas(16) float t_near[WideBvhNode::kWidth];
+        int mask = node.Hit(origin, inv_dir, r.dir_is_neg, static_cast<float>(t_min), static_cast<float>(t_max), t_near);
+
+        // Push the hit lanes far to near, so the nearest child is popped first
+        int base = top;
+        for (int lane = 0; lane < WideBvhNode::kWidth; ++lane) {
+            if (!(mask & (1 << lane))) continue;
+
+            Entry child = { node.child[lane], node.count[lane], t_near[lane] };
+            int i = top++;
+            while (i > base && stack[i - 1].t_near < child.t_near) {
+                stack[i] = stack[i - 1];
+                --i;
+            }
+            stack[i] = child;
+        }
+    }
+
+    return hit;
+}
@@ -1,9 +1,11 @@
 #pragma once
 
+#include <cstring>
 #include "hittable.h"
 #include "material.h"
 #include "texture.h"
 #include "math/util.h"
+#include "math/rand.h"
 
 class ConstantMedium : public Hittable  {
     public:
@@ -25,12 +27,26 @@ class ConstantMedium : public Hittable  {
 
         virtual bool Hit(const Ray& r, XFloat t_min, XFloat t_max, HitResult& rec) const override;
 
+    private:
+        static uint64_t HashRay(const Ray& r);
+
     public:
         std::shared_ptr<Hittable> boundary;
         std::shared_ptr<Material> phase_function;
         XFloat neg_inv_density;
 };
 
+uint64_t ConstantMedium::HashRay(const Ray& r) {
+    const XFloat values[7] = { r.origin.x, r.origin.y, r.origin.z, r.direction.x, r.direction.y, r.direction.z, r.time };
+    uint64_t hash = 0;
+    for (XFloat value : values) {
+        uint64_t bits = 0;
+        std::memcpy(&bits, &value, sizeof(value));
+        hash = math::MixBits(hash ^ bits);
+    }
+    return hash;
+}
+
 bool ConstantMedium::Hit(const Ray& r, XFloat t_min, XFloat t_max, HitResult& rec) const {
     // Print occasional samples when debugging. To enable, set enableDebug true.
     // const bool enableDebug = false;
@@ -57,7 +73,10 @@ bool ConstantMedium::Hit(const Ray& r, XFloat t_min, XFloat t_max, HitResult& re
 
     const auto ray_length = r.direction.Magnitude();
     const auto distance_inside_boundary = (rec2.t - rec1.t) * ray_length;
-    const auto rd = math::random::Random<XFloat>();
+    // Hit has no sampler to draw from, so the free path comes from a generator
+    // keyed by the ray itself and does not depend on the thread tracing it
+    math::Rand rng(HashRay(r));
+    const auto rd = math::random::Random<XFloat>(rng);
     const auto hit_distance = neg_inv_density * std::log(rd);
 
     if (hit_distance > distance_inside_boundary)
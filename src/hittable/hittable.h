@@ -7,6 +7,26 @@
 #include "math/vec2.h"
 
 class Material;
+class ThreadPool;
+
+namespace math {
+class Rand;
+}
+
+enum class BvhSplit {
+    kMiddle, // object median along the longest centroid axis
+    kSAH,    // binned surface area heuristic
+};
+
+enum class BvhLayout {
+    kBinary, // 32-byte binary nodes
+    kWide,   // binary tree collapsed into 4-wide nodes whose boxes are tested at once
+};
+
+struct BvhOptions {
+    BvhSplit split = BvhSplit::kSAH;
+    BvhLayout layout = BvhLayout::kWide;
+};
 
 struct HitResult {
     Vec3f p;
@@ -29,11 +49,24 @@ public:
 
     virtual bool Hit(const Ray& r, XFloat t_min, XFloat t_max, HitResult& rec) const = 0;
 
+    // Whether anything is hit within [t_min, t_max], for shadow rays: stops at the first
+    // hit found and skips the attributes Hit fills in
+    virtual bool Occluded(const Ray& r, XFloat t_min, XFloat t_max) const {
+        HitResult rec;
+        return Hit(r, t_min, t_max, rec);
+    }
+
     virtual XFloat PDF(const Vec3f& o, const Vec3f& v) const {
         return 0.0;
     }
 
-    virtual Vec3f Sample(const Vec3f& o) const {
+    // PDF of v when Ray(o, v) is already known to hit this object at rec, saves
+    // intersecting it again
+    virtual XFloat PDF(const Vec3f& o, const Vec3f& v, const HitResult&) const {
+        return PDF(o, v);
+    }
+
+    virtual Vec3f Sample(const Vec3f&, math::Rand&) const {
         return Vec3f(1,0,0);
     }
 
@@ -41,8 +74,22 @@ public:
         return bounding_box_;
     };
 
+    // Surface area, lights are picked in proportion to area times emission
+    virtual XFloat Area() const {
+        return 0.0;
+    }
+
+    // Cone around w holding the outward normals of the surface, cos_theta is the cosine
+    // of its half angle. Lets the light BVH skip lights facing away from a point.
+    virtual void NormalBounds(Vec3f& w, XFloat& cos_theta) const {
+        w = Vec3f(0, 0, 1);
+        cos_theta = -1;
+    }
+
+    Material* material() const { return mat_ptr_.get(); }
+
     virtual void FetchLight(std::vector<std::shared_ptr<Hittable>>& lights);
-    virtual void BuildBVH() {};
+    virtual void BuildBVH(const BvhOptions&, ThreadPool*) {};
 
 protected:
     std::shared_ptr<Material> mat_ptr_;
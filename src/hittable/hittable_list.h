@@ -24,10 +24,10 @@ public:
         }
     }
 
-    void BuildBVH() override {
+    void BuildBVH(const BvhOptions& options, ThreadPool* pool) override {
         if (objects.empty()) return;
 
-        root = std::make_shared<BvhNode>(objects, 0, objects.size());
+        root = std::make_shared<Bvh>(objects, options, pool);
     }
 
     bool Hit(const Ray& r, XFloat t_min, XFloat t_max, HitResult& rec) const override {
@@ -35,6 +35,12 @@ public:
         return root->Hit(r, t_min, t_max, rec);
     }
 
+    bool Occluded(const Ray& r, XFloat t_min, XFloat t_max) const override {
+        if (!root) return false;
+        return root->Occluded(r, t_min, t_max);
+    }
+
+    using Hittable::PDF;
     XFloat PDF(const Vec3f& o, const Vec3f& wo) const override {
         if (empty()) return 0;
 
@@ -47,13 +53,13 @@ public:
         return sum * weight;
     }
 
-    Vec3f Sample(const Vec3f &o) const override {
+    Vec3f Sample(const Vec3f &o, math::Rand& rng) const override {
         if (empty()) {
             return Vec3f::zero;
         }
         
         auto int_size = static_cast<int>(objects.size());
-        return objects[math::random::Random(0, int_size-1)]->Sample(o);
+        return objects[math::random::Random(rng, 0, int_size-1)]->Sample(o, rng);
     }
 
     void FetchLight(std::vector<std::shared_ptr<Hittable>>& lights) override {
@@ -63,6 +69,6 @@ public:
 
 public:
     std::vector<std::shared_ptr<Hittable>> objects;
-    std::shared_ptr<BvhNode> root;
+    std::shared_ptr<Bvh> root;
 };
 
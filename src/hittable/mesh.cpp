@@ -1,7 +1,10 @@
 #include "mesh.h"
+#include <iostream>
+#include <sstream>
 #include "3rdparty/obj_loader.h"
 #include "triangle.h"
 #include "math/mat4.h"
+#include "material.h"
 
 std::shared_ptr<Mesh> Mesh::CreateBox(const Vec3f& position, const Quaternion& rotation, XFloat scale, std::shared_ptr<Material> mat) { 
     Vec3f vertices[] = {
@@ -90,6 +93,9 @@ Mesh::Mesh(const Vec3f& position, const Quaternion& rotation, XFloat scale, cons
     center /= total;
 
     for(auto& mesh : loader.LoadedMeshes) {
+        // Indices of every loaded mesh are relative to its own vertices
+        uint32_t base = static_cast<uint32_t>(positions_.size());
+
         for (auto& vertex : mesh.Vertices) {
             Vec3f pos(vertex.Position.X, vertex.Position.Y, -vertex.Position.Z);
             pos -= center;
@@ -103,31 +109,29 @@ Mesh::Mesh(const Vec3f& position, const Quaternion& rotation, XFloat scale, cons
             );
         }
 
-        for (int i = 0; i < mesh.Indices.size(); i+=3) {
-            auto i0 = mesh.Indices[i];
-            auto i1 = mesh.Indices[i+2];
-            auto i2 = mesh.Indices[i+1];
-
-            auto& v0 = vertices_[i0];
-            auto& v1 = vertices_[i1];
-            auto& v2 = vertices_[i2];
+        // Bitangents only orient the tangents, they are not kept
+        std::vector<Vec3f> bitangents(mesh.Vertices.size(), Vec3f::zero);
+        for (size_t i = 0; i < mesh.Indices.size(); i+=3) {
+            auto i0 = base + mesh.Indices[i];
+            auto i1 = base + mesh.Indices[i+2];
+            auto i2 = base + mesh.Indices[i+1];
 
             Vec3f tangent, bitangent;
-            Vertex::CalcTangent(v0, v1, v2, tangent, bitangent);
-            v0.tangent += tangent;
-            v1.tangent += tangent;
-            v2.tangent += tangent;
-
-            v0.bitangent += bitangent;
-            v1.bitangent += bitangent;
-            v2.bitangent += bitangent;
+            Vertex::CalcTangent(positions_[i0], positions_[i1], positions_[i2],
+                texcoords_[i0], texcoords_[i1], texcoords_[i2], tangent, bitangent);
+            tangents_[i0] += tangent;
+            tangents_[i1] += tangent;
+            tangents_[i2] += tangent;
+
+            bitangents[i0 - base] += bitangent;
+            bitangents[i1 - base] += bitangent;
+            bitangents[i2 - base] += bitangent;
         }
 
-        for (int i = 0; i < vertices_.size(); ++i) {
-            auto& v = vertices_[i];
-            Vec3f normal = v.normal;
-            Vec3f tangent = v.tangent;
-            Vec3f bitangent = v.bitangent;
+        for (size_t i = base; i < positions_.size(); ++i) {
+            Vec3f normal = normals_[i];
+            Vec3f tangent = tangents_[i];
+            Vec3f bitangent = bitangents[i - base];
 
             tangent = (tangent - (normal.Dot(tangent) * normal)).Normalize();
             float c = normal.Cross(tangent).Dot(bitangent);
@@ -135,13 +139,14 @@ Mesh::Mesh(const Vec3f& position, const Quaternion& rotation, XFloat scale, cons
                 tangent *= -1.0f;
             }
 
-            v.tangent = tangent;
+            tangents_[i] = tangent;
         }
 
-        for (int i = 0; i < mesh.Indices.size(); i+=3) {
-            auto i0 = mesh.Indices[i+2];
-            auto i1 = mesh.Indices[i+1];
-            auto i2 = mesh.Indices[i];
+        triangles_.reserve(triangles_.size() + mesh.Indices.size() / 3);
+        for (size_t i = 0; i < mesh.Indices.size(); i+=3) {
+            auto i0 = base + mesh.Indices[i+2];
+            auto i1 = base + mesh.Indices[i+1];
+            auto i2 = base + mesh.Indices[i];
             AddTriangle(i0, i1, i2);
         }
     }
@@ -153,30 +158,113 @@ Mesh::Mesh(const Vec3f& position, const Quaternion& rotation, std::shared_ptr<Ma
 }
 
 void Mesh::AddVertex(Vec3f pos, Vec3f normal, Vec2f uv) {
-    vertices_.emplace_back(pos, normal, uv);
+    positions_.push_back(pos);
+    normals_.push_back(normal);
+    tangents_.push_back(Vec3f::zero);
+    texcoords_.push_back(uv);
 }
 
 void Mesh::AddTriangle(uint32_t i0, uint32_t i1, uint32_t i2) {
-    auto& v0 = vertices_[i0];
-    auto& v1 = vertices_[i1];
-    auto& v2 = vertices_[i2];
-    auto tri = std::make_shared<Triangle>(v0, v1, v2, mat_ptr_, interpolate_normal_);
+    triangles_.push_back({ i0, i1, i2 });
 
-    triangles_.push_back(tri);
+    AABB box = Triangle::Bounds(positions_[i0], positions_[i1], positions_[i2]);
     if (triangles_.size() == 1) {
-        bounding_box_ = tri->bounding_box();
+        bounding_box_ = box;
     } else {
-        bounding_box_ = AABB::Union(bounding_box_, tri->bounding_box());
+        bounding_box_ = AABB::Union(bounding_box_, box);
     }
 }
 
 bool Mesh::Hit(const Ray& r, XFloat t_min, XFloat t_max, HitResult& rec) const {
-    if (!root_) return false;
-    return root_->Hit(r, t_min, t_max, rec);
+    uint32_t index = 0;
+    XFloat t = 0, u = 0, v = 0;
+    bool hit = tree_.TraverseLeaves(r, t_min, t_max, [&](uint32_t offset, uint32_t, XFloat t0, XFloat& t1) {
+        const auto& packet = packets_[offset];
+        XFloat ti, ui, vi;
+        int lane = packet.Intersect(r, t0, t1, ti, ui, vi);
+        if (lane < 0) {
+            return false;
+        }
+        t1 = t = ti;
+        u = ui;
+        v = vi;
+        index = packet.index[lane];
+        return true;
+    });
+
+    if (!hit) return false;
+
+    // Attributes are only interpolated for the closest hit
+    const auto& tri = triangles_[index];
+    XFloat w = 1.0 - u - v;
+    Vec3f outward_normal;
+    if (interpolate_normal_) {
+        outward_normal = normals_[tri.v[0]] * w + normals_[tri.v[1]] * u + normals_[tri.v[2]] * v;
+    } else {
+        const Vec3f& p0 = positions_[tri.v[0]];
+        outward_normal = (positions_[tri.v[1]] - p0).Cross(positions_[tri.v[2]] - p0).Normalize();
+    }
+
+    rec.t = t;
+    rec.p = r.at(t);
+    rec.SetFaceNormal(r, outward_normal);
+    rec.uv = texcoords_[tri.v[0]] * w + texcoords_[tri.v[1]] * u + texcoords_[tri.v[2]] * v;
+    rec.mat_ptr = mat_ptr_.get();
+
+    return true;
+}
+
+bool Mesh::Occluded(const Ray& r, XFloat t_min, XFloat t_max) const {
+    return tree_.TraverseAny(r, t_min, t_max, [&](uint32_t offset, uint32_t, XFloat t0, XFloat t1) {
+        return packets_[offset].Occluded(r, t0, t1);
+    });
 }
 
-void Mesh::BuildBVH() {
+void Mesh::BuildBVH(const BvhOptions& options, ThreadPool* pool) {
     if (triangles_.empty()) return;
-    root_ = std::make_shared<BvhNode>(triangles_, 0, triangles_.size());
+
+    std::vector<BvhPrimitive> refs(triangles_.size());
+    for (size_t i = 0; i < triangles_.size(); ++i) {
+        const auto& tri = triangles_[i];
+        refs[i].bounds = Triangle::Bounds(positions_[tri.v[0]], positions_[tri.v[1]], positions_[tri.v[2]]);
+        refs[i].centroid = (refs[i].bounds.min + refs[i].bounds.max) * 0.5;
+        refs[i].index = static_cast<uint32_t>(i);
+    }
+
+    tree_.Build(refs, options, pool, TrianglePacket::kWidth);
+
+    std::vector<MeshTriangle> ordered;
+    ordered.reserve(triangles_.size());
+    for (const auto& ref : refs) {
+        ordered.push_back(triangles_[ref.index]);
+    }
+    triangles_.swap(ordered);
+
+    packets_.clear();
+    tree_.RemapLeaves([this](uint32_t offset, uint32_t count) {
+        TrianglePacket packet;
+        for (uint32_t lane = 0; lane < count; ++lane) {
+            const auto& tri = triangles_[offset + lane];
+            packet.Set(lane, positions_[tri.v[0]], positions_[tri.v[1]], positions_[tri.v[2]], offset + lane);
+        }
+        packets_.push_back(packet);
+        return static_cast<uint32_t>(packets_.size() - 1);
+    });
+
+    // Meshes may be built concurrently, print the whole line at once
+    std::ostringstream os;
+    os << "Mesh BVH: " << triangles_.size() << " triangles, " << tree_.Stats() << ", built in " << tree_.build_time() << "s\n";
+    std::cout << os.str() << std::flush;
 }
 
+void Mesh::FetchLight(std::vector<std::shared_ptr<Hittable>>& lights) {
+    if (!mat_ptr_ || !mat_ptr_->IsLight()) return;
+
+    for (const auto& tri : triangles_) {
+        Vertex v[3];
+        for (int i = 0; i < 3; ++i) {
+            v[i] = Vertex(positions_[tri.v[i]], normals_[tri.v[i]], texcoords_[tri.v[i]]);
+        }
+        lights.push_back(std::make_shared<Triangle>(v[0], v[1], v[2], mat_ptr_, interpolate_normal_));
+    }
+}
@@ -9,11 +9,17 @@
 #include "hittable.h"
 #include "common/vertex.h"
 #include "common/transform.h"
-#include "bvh.h"
+#include "bvh_tree.h"
 #include "triangle.h"
+#include "triangle_packet.h"
 
-class BvhNode;
+// Indices of the three vertices of a mesh face, CW order
+struct MeshTriangle {
+    uint32_t v[3];
+};
 
+// Vertex attributes are kept as separate arrays shared by all faces, and faces
+// are plain index triples. Every BVH leaf is packed into a TrianglePacket.
 class Mesh : public Hittable {
 public:
     static std::shared_ptr<Mesh> CreateBox(const Vec3f& position, const Quaternion& rotation, XFloat scale, std::shared_ptr<Material> mat);
@@ -21,22 +27,32 @@ public:
     Mesh(const Vec3f& position, const Quaternion& rotaton, XFloat scale, const char* filename, std::shared_ptr<Material> mat, bool interpolate_normal = true);
     Mesh(const Vec3f& position, const Quaternion& rotaton, std::shared_ptr<Material> mat, bool interpolate_normal = true);
 
-    const std::vector<Vertex>& vertices() const { return vertices_; }
-    const std::vector<std::shared_ptr<Hittable>>& triangles() const { return triangles_; }
+    size_t vertex_count() const { return positions_.size(); }
+    const std::vector<Vec3f>& positions() const { return positions_; }
+    const std::vector<Vec3f>& normals() const { return normals_; }
+    const std::vector<Vec3f>& tangents() const { return tangents_; }
+    const std::vector<Vec2f>& texcoords() const { return texcoords_; }
+    const std::vector<MeshTriangle>& triangles() const { return triangles_; }
 
     void AddVertex(Vec3f pos, Vec3f normal, Vec2f uv);
     void AddTriangle(uint32_t idx1, uint32_t idx2, uint32_t idx3);
 
     bool Hit(const Ray& r, XFloat t_min, XFloat t_max, HitResult& rec) const override;
+    bool Occluded(const Ray& r, XFloat t_min, XFloat t_max) const override;
     // XFloat PDF(const Vec3f& o, const Vec3f& v) const override;
-    // Vec3f Sample(const Vec3f& o) const override;
-    void BuildBVH() override;
+    // Vec3f Sample(const Vec3f& o, math::Rand& rng) const override;
+    void BuildBVH(const BvhOptions& options, ThreadPool* pool) override;
+    // An emissive mesh is sampled per face, every face becomes a Triangle light
+    void FetchLight(std::vector<std::shared_ptr<Hittable>>& lights) override;
 
 private:
-    std::vector<Vertex> vertices_;
-    std::vector<std::shared_ptr<Hittable>> triangles_;
-    std::shared_ptr<BvhNode> root_;
+    std::vector<Vec3f> positions_;
+    std::vector<Vec3f> normals_;
+    std::vector<Vec3f> tangents_;
+    std::vector<Vec2f> texcoords_;
+    std::vector<MeshTriangle> triangles_;
+    std::vector<TrianglePacket> packets_;
+    BvhTree tree_;
     Transform transform_;
     bool interpolate_normal_;
 };
-
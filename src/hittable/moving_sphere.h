@@ -16,6 +16,7 @@ public:
     };
 
     virtual bool Hit(const Ray& r, XFloat tmin, XFloat tmax, HitResult& rec) const override;
+    bool Occluded(const Ray& r, XFloat t_min, XFloat t_max) const override;
 
     Vec3f center(XFloat t) const {
         return center0 + ((t - time0) / (time1 - time0)) * (center1 - center0);
@@ -31,23 +32,9 @@ public:
 
 bool MovingSphere::Hit(const Ray& r, XFloat t_min, XFloat t_max, HitResult& res) const {
     Vec3f cent = center(r.time);
-    Vec3f oc = r.origin - cent;
-    auto a = r.direction.MagnitudeSq();
-    auto half_b = oc.Dot(r.direction);
-    auto c = oc.MagnitudeSq() - radius*radius;
-    auto discriminant = half_b*half_b - a*c;
-
-    if (discriminant < 0 ) return false;
-
-    auto sqrtd = sqrt(discriminant);
-    auto root = (-half_b - sqrtd) / a;
-
-    if (root < t_min || root > t_max) {
-        root = (-half_b + sqrtd) / a;
-        if (root < t_min || root > t_max) {
-            return false;
-        }
-    }
+    XFloat root;
+    if (!Sphere::Intersect(r, cent, radius, t_min, t_max, root))
+        return false;
 
     res.t = root;
     res.p = r.at(res.t);
@@ -57,3 +44,8 @@ bool MovingSphere::Hit(const Ray& r, XFloat t_min, XFloat t_max, HitResult& res)
     res.mat_ptr = mat_ptr_.get();
     return true;
 }
+
+bool MovingSphere::Occluded(const Ray& r, XFloat t_min, XFloat t_max) const {
+    XFloat t;
+    return Sphere::Intersect(r, center(r.time), radius, t_min, t_max, t);
+}
@@ -15,10 +15,15 @@ public:
     };
 
     virtual bool Hit(const Ray& r, XFloat tmin, XFloat tmax, HitResult& rec) const override;
+    bool Occluded(const Ray& r, XFloat t_min, XFloat t_max) const override;
     XFloat PDF(const Vec3f& o, const Vec3f& v) const override;
-    Vec3f Sample(const Vec3f& o) const override;
+    XFloat PDF(const Vec3f& o, const Vec3f& v, const HitResult& rec) const override;
+    Vec3f Sample(const Vec3f& o, math::Rand& rng) const override;
+    XFloat Area() const override { return 4 * math::kPI * radius * radius; }
 
     static Vec2f GetUV(const Vec3f& p);
+    // Nearest root within [t_min, t_max] of the ray against the sphere
+    static bool Intersect(const Ray& r, const Vec3f& center, XFloat radius, XFloat t_min, XFloat t_max, XFloat& t);
 public:
     Vec3f center;
     XFloat radius;
@@ -38,7 +43,7 @@ Vec2f Sphere::GetUV(const Vec3f& p) {
     return Vec2f(phi / (2 * math::kPI), theta / math::kPI);
 }
 
-bool Sphere::Hit(const Ray& r, XFloat t_min, XFloat t_max, HitResult& res) const {
+bool Sphere::Intersect(const Ray& r, const Vec3f& center, XFloat radius, XFloat t_min, XFloat t_max, XFloat& t) {
     Vec3f oc = r.origin - center;
     auto a = r.direction.MagnitudeSq();
     auto half_b = oc.Dot(r.direction);
@@ -57,6 +62,15 @@ bool Sphere::Hit(const Ray& r, XFloat t_min, XFloat t_max, HitResult& res) const
         }
     }
 
+    t = root;
+    return true;
+}
+
+bool Sphere::Hit(const Ray& r, XFloat t_min, XFloat t_max, HitResult& res) const {
+    XFloat root;
+    if (!Intersect(r, center, radius, t_min, t_max, root))
+        return false;
+
     res.t = root;
     res.p = r.at(res.t);
     Vec3f outward_normal = (res.p - center).Normalize();
@@ -66,21 +80,31 @@ bool Sphere::Hit(const Ray& r, XFloat t_min, XFloat t_max, HitResult& res) const
     return true;
 }
 
+bool Sphere::Occluded(const Ray& r, XFloat t_min, XFloat t_max) const {
+    XFloat t;
+    return Intersect(r, center, radius, t_min, t_max, t);
+}
+
 XFloat Sphere::PDF(const Vec3f& o, const Vec3f& v) const {
-    HitResult rec;
-    if (!Hit(Ray(o, v), 0.001, math::kInfinite, rec))
+    if (!Occluded(Ray(o, v), 0.001, math::kInfinite))
         return 0;
 
+    return PDF(o, v, HitResult());
+}
+
+// Uniform over the cone the sphere subtends, where on the sphere v lands does not matter
+XFloat Sphere::PDF(const Vec3f& o, const Vec3f&, const HitResult&) const {
     auto cos_theta_max = sqrt(1 - radius*radius/(center-o).MagnitudeSq());
     auto solid_angle = 2 * math::kPI * (1-cos_theta_max);
 
     return  1 / solid_angle;
 }
 
-Vec3f Sphere::Sample(const Vec3f& o) const {
-     Vec3f direction = o - center;
+Vec3f Sphere::Sample(const Vec3f& o, math::Rand& rng) const {
+     // The cone of directions from o to the sphere, the one PDF describes
+     Vec3f direction = center - o;
      auto distance_squared = direction.MagnitudeSq();
      ONB uvw;
      uvw.BuildFromW(direction);
-     return uvw.local(random_to_sphere(radius, distance_squared));
+     return uvw.local(random_to_sphere(rng, radius, distance_squared));
 }
@@ -31,16 +31,37 @@ Triangle::Triangle(const Vertex& a, const Vertex& b, const Vertex& c, std::share
     area = normal.Magnitude() * 0.5f;
     normal.Normalized();
 
-    Vec3f min = Vec3f::Min(v0.position, Vec3f::Min(v1.position, v2.position));
-    Vec3f max = Vec3f::Max(v0.position, Vec3f::Max(v1.position, v2.position));
+    bounding_box_ = Bounds(v0.position, v1.position, v2.position);
+}
+
+AABB Triangle::Bounds(const Vec3f& a, const Vec3f& b, const Vec3f& c) {
+    Vec3f min = Vec3f::Min(a, Vec3f::Min(b, c));
+    Vec3f max = Vec3f::Max(a, Vec3f::Max(b, c));
     for (int i = 0; i < 3; ++i) {
         if (math::Abs(max[i] - min[i]) < math::kEpsilon) {
             min[i] -= 0.0001;
             max[i] += 0.0001;
         }
     }
-    
-    bounding_box_ = AABB(min, max);
+
+    return AABB(min, max);
+}
+
+void Triangle::NormalBounds(Vec3f& w, XFloat& cos_theta) const {
+    w = normal;
+    cos_theta = 1;
+    if (!interpolate_normal) return;
+
+    // Interpolated normals are positive combinations of the vertex normals
+    Vec3f sum = v0.normal.Normalize() + v1.normal.Normalize() + v2.normal.Normalize();
+    if (sum.MagnitudeSq() < math::kEpsilon) {
+        cos_theta = -1;
+        return;
+    }
+    w = sum.Normalize();
+    cos_theta = math::Min(w.Dot(v0.normal.Normalize()), math::Min(w.Dot(v1.normal.Normalize()), w.Dot(v2.normal.Normalize())));
+    // Past a half sphere the cone is no longer convex and may miss their combinations
+    if (cos_theta <= 0) cos_theta = -1;
 }
 
 bool Triangle::Hit(const Ray& r, XFloat t_min, XFloat t_max, HitResult& rec) const {
@@ -66,13 +87,23 @@ bool Triangle::Hit(const Ray& r, XFloat t_min, XFloat t_max, HitResult& rec) con
     return true;
 }
 
+bool Triangle::Occluded(const Ray& r, XFloat t_min, XFloat t_max) const {
+    XFloat t;
+    return Intersects(r, t_min, t_max, t);
+}
+
 XFloat Triangle::PDF(const Vec3f& o, const Vec3f& v) const {
     HitResult rec;
-    if (!Hit(Ray(o, v), 0.0, math::kInfinite, rec)) {
+    if (!Intersects(Ray(o, v), 0.0, math::kInfinite, rec.t)) {
         return 0.0;
     }
-    
-    const XFloat dist2 = (rec.p - o).MagnitudeSq();
+
+    return PDF(o, v, rec);
+}
+
+XFloat Triangle::PDF(const Vec3f&, const Vec3f& v, const HitResult& rec) const {
+    // The geometric normal, the area is sampled uniformly whatever the shading normal
+    const XFloat dist2 = rec.t * rec.t * v.MagnitudeSq();
     const XFloat cosine = math::Abs(v.Dot(normal));
 
     return dist2 / (cosine * area);
@@ -80,9 +111,9 @@ XFloat Triangle::PDF(const Vec3f& o, const Vec3f& v) const {
 
 // see Osada et All, Shape Distributions, section 4.2
 // http://www.cs.princeton.edu/~funk/tog02.pdf
-Vec3f Triangle::Sample(const Vec3f& o) const {
-    XFloat x = std::sqrt(math::random::Random<XFloat>());
-    XFloat y = math::random::Random<XFloat>();
+Vec3f Triangle::Sample(const Vec3f& o, math::Rand& rng) const {
+    XFloat x = std::sqrt(math::random::Random<XFloat>(rng));
+    XFloat y = math::random::Random<XFloat>(rng);
     auto point = v0.position * (1.0 - x) + v1.position * (x * (1.0 - y)) + v2.position * (x * y);
     return (point - o).Normalize();
 }
@@ -91,14 +122,19 @@ bool Triangle::Intersects(const Ray& ray, XFloat& t) const {
     return Intersects(ray, 0.0, std::numeric_limits<XFloat>::max(), t);
 }
 
+bool Triangle::Intersects(const Ray& ray, XFloat t_min, XFloat t_max, XFloat& t) const {
+    XFloat u, v;
+    return Intersect(ray, v0.position, v1.position, v2.position, t_min, t_max, t, u, v);
+}
+
 // Fast, minimum storage ray-triangle intersection.
 // Tomas Möller and Ben Trumbore. 
 // Journal of Graphics Tools, 2(1):21--28, 1997. 
 // http://www.graphics.cornell.edu/pubs/1997/MT97.pdf
-bool Triangle::Intersects(const Ray& ray, XFloat t_min, XFloat t_max, XFloat& t) const {
+bool Triangle::Intersect(const Ray& ray, const Vec3f& a, const Vec3f& b, const Vec3f& c, XFloat t_min, XFloat t_max, XFloat& t, XFloat& u, XFloat& v) {
     // Edge vectors
-    Vec3f e1 = v1.position - v0.position;
-    Vec3f e2 = v2.position - v0.position;
+    Vec3f e1 = b - a;
+    Vec3f e2 = c - a;
 
     // begin calculating determinant - also used to calculate U parameter
     Vec3f pvec = ray.direction.Cross(e2);
@@ -113,10 +149,10 @@ bool Triangle::Intersects(const Ray& ray, XFloat t_min, XFloat t_max, XFloat& t)
     const float inv_det = 1.f / det;
 
     // Calculate distance from v0 to ray origin
-    Vec3f tvec = ray.origin - v0.position;
+    Vec3f tvec = ray.origin - a;
 
     // Output barycentric u
-    XFloat u = tvec.Dot(pvec) * inv_det;
+    u = tvec.Dot(pvec) * inv_det;
     if (u < 0.0 || u > 1.0)
         return false; // Barycentric U is outside the triangle - early out.
 
@@ -124,7 +160,7 @@ bool Triangle::Intersects(const Ray& ray, XFloat t_min, XFloat t_max, XFloat& t)
     Vec3f qvec = tvec.Cross(e1);
 
     // Output barycentric v
-    XFloat v = ray.direction.Dot(qvec) * inv_det;
+    v = ray.direction.Dot(qvec) * inv_det;
     if (v < 0 || u + v > 1.0) // Barycentric V or the combination of U and V are outside the triangle - no intersection.
         return false;
 
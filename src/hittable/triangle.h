@@ -7,6 +7,9 @@
 class Triangle : public Hittable {
 public:
     static void Barycentric(const Vec3f& p, const Vec3f& a, const Vec3f& b, const Vec3f& c, XFloat& u, XFloat& v, XFloat& w);
+    static AABB Bounds(const Vec3f& a, const Vec3f& b, const Vec3f& c);
+    // u and v are the barycentric weights of b and c at the hit point
+    static bool Intersect(const Ray& ray, const Vec3f& a, const Vec3f& b, const Vec3f& c, XFloat t_min, XFloat t_max, XFloat& t, XFloat& u, XFloat& v);
 
     Triangle(const Vertex& a, const Vertex& b, const Vertex& c, std::shared_ptr<Material> mat, bool interpolate_normal_=true);
 
@@ -14,8 +17,12 @@ public:
     bool Intersects(const Ray& ray, XFloat t_min, XFloat t_max, XFloat& t) const;
 
     bool Hit(const Ray& r, XFloat t_min, XFloat t_max, HitResult& rec) const override;
+    bool Occluded(const Ray& r, XFloat t_min, XFloat t_max) const override;
     XFloat PDF(const Vec3f& o, const Vec3f& v) const override;
-    Vec3f Sample(const Vec3f& o) const override;
+    XFloat PDF(const Vec3f& o, const Vec3f& v, const HitResult& rec) const override;
+    Vec3f Sample(const Vec3f& o, math::Rand& rng) const override;
+    XFloat Area() const override { return area; }
+    void NormalBounds(Vec3f& w, XFloat& cos_theta) const override;
 
     //CW order
     Vertex v0;
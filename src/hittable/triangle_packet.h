@@ -0,0 +1,166 @@
+#pragma once
+
+#include <cstdint>
+#include "math/simd.h"
+#include "math/vec3.h"
+#include "common/ray.h"
+
+// Four triangles with precomputed edges, stored lane by lane for a 4-wide
+// Möller-Trumbore test. Empty lanes have zero edges and never hit.
+struct alignas(16) TrianglePacket {
+    static constexpr int kWidth = 4;
+    static constexpr uint32_t kEmpty = 0xffffffff;
+
+    TrianglePacket() {
+        for (int i = 0; i < 3; ++i) {
+            for (int lane = 0; lane < kWidth; ++lane) {
+                v0[i][lane] = 0;
+                e1[i][lane] = 0;
+                e2[i][lane] = 0;
+            }
+        }
+        for (int lane = 0; lane < kWidth; ++lane) {
+            index[lane] = kEmpty;
+        }
+    }
+
+    void Set(int lane, const Vec3f& a, const Vec3f& b, const Vec3f& c, uint32_t idx) {
+        for (int i = 0; i < 3; ++i) {
+            v0[i][lane] = static_cast<float>(a[i]);
+            e1[i][lane] = static_cast<float>(b[i] - a[i]);
+            e2[i][lane] = static_cast<float>(c[i] - a[i]);
+        }
+        index[lane] = idx;
+    }
+
+    // Closest lane hit within [t_min, t_max], or -1. u and v are the barycentric weights of b and c.
+    int Intersect(const Ray& r, XFloat t_min, XFloat t_max, XFloat& t, XFloat& u, XFloat& v) const;
+    // Whether any lane is hit within [t_min, t_max]
+    bool Occluded(const Ray& r, XFloat t_min, XFloat t_max) const;
+
+    float v0[3][kWidth];
+    float e1[3][kWidth];
+    float e2[3][kWidth];
+    uint32_t index[kWidth];
+
+private:
+    // Mask of the lanes hit within [t_min, t_max], their t, u and v are stored per lane
+    int Test(const Ray& r, XFloat t_min, XFloat t_max, float lane_t[kWidth], float lane_u[kWidth], float lane_v[kWidth]) const;
+};
+
+inline int TrianglePacket::Intersect(const Ray& r, XFloat t_min, XFloat t_max, XFloat& t, XFloat& u, XFloat& v) const {
+    alignas(16) float lane_t[kWidth];
+    alignas(16) float lane_u[kWidth];
+    alignas(16) float lane_v[kWidth];
+    int mask = Test(r, t_min, t_max, lane_t, lane_u, lane_v);
+    if (mask == 0) return -1;
+
+    int best = -1;
+    for (int lane = 0; lane < kWidth; ++lane) {
+        if ((mask & (1 << lane)) && (best < 0 || lane_t[lane] < lane_t[best])) {
+            best = lane;
+        }
+    }
+
+    t = lane_t[best];
+    u = lane_u[best];
+    v = lane_v[best];
+    return best;
+}
+
+inline bool TrianglePacket::Occluded(const Ray& r, XFloat t_min, XFloat t_max) const {
+    alignas(16) float lane_t[kWidth];
+    alignas(16) float lane_u[kWidth];
+    alignas(16) float lane_v[kWidth];
+    return Test(r, t_min, t_max, lane_t, lane_u, lane_v) != 0;
+}
+
+inline int TrianglePacket::Test(const Ray& r, XFloat t_min, XFloat t_max, float lane_t[kWidth], float lane_u[kWidth], float lane_v[kWidth]) const {
+    int mask = 0;
+
+#ifdef RAYTOY_SSE
+    const __m128 dx = _mm_set1_ps(static_cast<float>(r.direction.x));
+    const __m128 dy = _mm_set1_ps(static_cast<float>(r.direction.y));
+    const __m128 dz = _mm_set1_ps(static_cast<float>(r.direction.z));
+
+    const __m128 e1x = _mm_load_ps(e1[0]);
+    const __m128 e1y = _mm_load_ps(e1[1]);
+    const __m128 e1z = _mm_load_ps(e1[2]);
+    const __m128 e2x = _mm_load_ps(e2[0]);
+    const __m128 e2y = _mm_load_ps(e2[1]);
+    const __m128 e2z = _mm_load_ps(e2[2]);
+
+    // pvec = d x e2, det = e1 . pvec
+    const __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    const __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    const __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+    const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+    const __m128 abs_det = _mm_andnot_ps(_mm_set1_ps(-0.0f), det);
+    __m128 valid = _mm_cmpge_ps(abs_det, _mm_set1_ps(static_cast<float>(math::kEpsilon)));
+    if (_mm_movemask_ps(valid) == 0) return 0;
+
+    const __m128 inv_det = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+    // tvec = o - v0, u = tvec . pvec
+    const __m128 tx = _mm_sub_ps(_mm_set1_ps(static_cast<float>(r.origin.x)), _mm_load_ps(v0[0]));
+    const __m128 ty = _mm_sub_ps(_mm_set1_ps(static_cast<float>(r.origin.y)), _mm_load_ps(v0[1]));
+    const __m128 tz = _mm_sub_ps(_mm_set1_ps(static_cast<float>(r.origin.z)), _mm_load_ps(v0[2]));
+    const __m128 bu = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), inv_det);
+    valid = _mm_and_ps(valid, _mm_cmpge_ps(bu, _mm_setzero_ps()));
+
+    // qvec = tvec x e1, v = d . qvec, t = e2 . qvec
+    const __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+    const __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+    const __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+    const __m128 bv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv_det);
+    valid = _mm_and_ps(valid, _mm_cmpge_ps(bv, _mm_setzero_ps()));
+    valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(bu, bv), _mm_set1_ps(1.0f)));
+
+    const __m128 bt = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv_det);
+    valid = _mm_and_ps(valid, _mm_cmpge_ps(bt, _mm_set1_ps(static_cast<float>(t_min))));
+    valid = _mm_and_ps(valid, _mm_cmple_ps(bt, _mm_set1_ps(static_cast<float>(t_max))));
+
+    mask = _mm_movemask_ps(valid);
+    if (mask == 0) return 0;
+
+    _mm_store_ps(lane_t, bt);
+    _mm_store_ps(lane_u, bu);
+    _mm_store_ps(lane_v, bv);
+#else
+    const float d[3] = { static_cast<float>(r.direction.x), static_cast<float>(r.direction.y), static_cast<float>(r.direction.z) };
+    const float o[3] = { static_cast<float>(r.origin.x), static_cast<float>(r.origin.y), static_cast<float>(r.origin.z) };
+
+    for (int lane = 0; lane < kWidth; ++lane) {
+        float p[3] = {
+            d[1] * e2[2][lane] - d[2] * e2[1][lane],
+            d[2] * e2[0][lane] - d[0] * e2[2][lane],
+            d[0] * e2[1][lane] - d[1] * e2[0][lane],
+        };
+        float det = e1[0][lane] * p[0] + e1[1][lane] * p[1] + e1[2][lane] * p[2];
+        if (det > -math::kEpsilon && det < math::kEpsilon) continue;
+
+        float inv_det = 1.0f / det;
+        float tv[3] = { o[0] - v0[0][lane], o[1] - v0[1][lane], o[2] - v0[2][lane] };
+        float bu = (tv[0] * p[0] + tv[1] * p[1] + tv[2] * p[2]) * inv_det;
+        if (bu < 0.0f) continue;
+
+        float q[3] = {
+            tv[1] * e1[2][lane] - tv[2] * e1[1][lane],
+            tv[2] * e1[0][lane] - tv[0] * e1[2][lane],
+            tv[0] * e1[1][lane] - tv[1] * e1[0][lane],
+        };
+        float bv = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * inv_det;
+        if (bv < 0.0f || bu + bv > 1.0f) continue;
+
+        float bt = (e2[0][lane] * q[0] + e2[1][lane] * q[1] + e2[2][lane] * q[2]) * inv_det;
+        if (bt < t_min || bt > t_max) continue;
+
+        lane_t[lane] = bt;
+        lane_u[lane] = bu;
+        lane_v[lane] = bv;
+        mask |= 1 << lane;
+    }
+#endif
+
+    return mask;
+}
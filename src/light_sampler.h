@@ -0,0 +1,454 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+#include "hittable/hittable.h"
+#include "hittable/bvh_tree.h"
+#include "material.h"
+#include "math/random.h"
+#include "util.h"
+
+enum class LightSampling {
+    kPower, // in proportion to power, wherever the shading point is
+    kBvh,   // walks a light BVH, weighing each subtree by its importance at the shading point
+    kNone,  // no light sampling, emission is only found by BSDF rays
+};
+
+// Cone of directions around w, cos_theta is the cosine of its half angle
+struct DirectionCone {
+    DirectionCone() : w(0, 0, 1), cos_theta(-1) {}
+    DirectionCone(const Vec3f& w_, XFloat cos_theta_) : w(w_), cos_theta(cos_theta_) {}
+
+    static DirectionCone Union(const DirectionCone& a, const DirectionCone& b);
+
+    Vec3f w;
+    XFloat cos_theta;
+};
+
+// Bounds of the emission of a set of lights (Conty Estevez and Kulla, "Importance
+// Sampling of Many Lights with Adaptive Tree Splitting"): their boxes, total power, the
+// cone of their normals and the spread of the emission around a normal, pi / 2 for the
+// diffuse lights here.
+struct LightBounds {
+    static constexpr XFloat kCosThetaEmission = 0;
+
+    // Conservative estimate of the light reaching p, zero only when none can
+    XFloat Importance(const Vec3f& p) const;
+    static LightBounds Union(const LightBounds& a, const LightBounds& b);
+
+    AABB bounds;
+    XFloat phi = 0;
+    DirectionCone normals;
+};
+
+// Picks one of the scene lights for a shading point, see LightSampling. With kPower the
+// lights are drawn from an alias table (Vose's method) with one random number. With kBvh
+// the pick descends a binary light BVH in O(log n), every light keeps the branches leading
+// to it so its probability is found again in O(log n). The density of a direction only
+// visits the lights the ray crosses, found through a BVH over the light geometry.
+class LightSampler : public Hittable {
+public:
+    LightSampler(const std::vector<std::shared_ptr<Hittable>>& lights, LightSampling sampling = LightSampling::kBvh);
+
+    size_t size() const { return lights_.size(); }
+    bool empty() const { return lights_.empty(); }
+
+    const std::shared_ptr<Hittable>& light(size_t i) const { return lights_[i]; }
+    // Probability of picking light i for a point at p
+    XFloat Pmf(const Vec3f& p, size_t i) const;
+    // size() when no light reaches p
+    size_t SampleIndex(const Vec3f& p, math::Rand& rng) const;
+
+    bool Hit(const Ray& r, XFloat t_min, XFloat t_max, HitResult& rec) const override;
+    // Density of picking the first light along v and sampling v from it, the only light
+    // a shadow ray in direction v can reach
+    XFloat VisiblePDF(const Vec3f& o, const Vec3f& v) const;
+
+private:
+    struct AliasEntry {
+        XFloat probability; // of keeping this entry instead of its alias
+        uint32_t alias;
+    };
+
+    // The first child of an interior node follows it, second_child is the other one.
+    // A leaf holds the light at index.
+    struct LightBvhNode {
+        LightBounds bounds;
+        uint32_t index;
+        bool leaf;
+    };
+
+    // Centroid buckets the SAOH splits are taken between
+    static constexpr int kBuckets = 12;
+    // Deeper than this splits in halves by count, the branch trail of a light fits in 64 bits
+    static constexpr int kMaxSaohDepth = 40;
+
+    void BuildAliasTable(const std::vector<XFloat>& weights);
+    uint32_t BuildLightBvh(std::vector<std::pair<uint32_t, LightBounds>>& lights, size_t start, size_t end,
+        uint64_t trail, int depth);
+    static XFloat SaohCost(const LightBounds& b, const AABB& parent, int axis);
+
+    LightSampling sampling_;
+    // In the leaf order of tree_
+    std::vector<std::shared_ptr<Hittable>> lights_;
+    std::vector<XFloat> pmf_;
+    std::vector<AliasEntry> alias_;
+    std::vector<LightBvhNode> nodes_;
+    // Branches from the root to each light, bit i set for the second child at depth i
+    std::vector<uint64_t> trails_;
+    BvhTree tree_;
+};
+
+namespace light_detail {
+
+inline XFloat SafeSqrt(XFloat v) {
+    return std::sqrt(math::Max(v, XFloat(0)));
+}
+
+inline XFloat SafeAcos(XFloat v) {
+    return std::acos(math::Clamp(v, XFloat(-1), XFloat(1)));
+}
+
+// Rotation of v by theta around the unit axis (Rodrigues)
+inline Vec3f Rotate(const Vec3f& v, const Vec3f& axis, XFloat theta) {
+    XFloat c = std::cos(theta), s = std::sin(theta);
+    return v * c + axis.Cross(v) * s + axis * (axis.Dot(v) * (1 - c));
+}
+
+// cos(max(0, a - b)) and sin(max(0, a - b)) from the sines and cosines of a and b
+inline XFloat CosSubClamped(XFloat sin_a, XFloat cos_a, XFloat sin_b, XFloat cos_b) {
+    return cos_a > cos_b ? 1 : cos_a * cos_b + sin_a * sin_b;
+}
+
+inline XFloat SinSubClamped(XFloat sin_a, XFloat cos_a, XFloat sin_b, XFloat cos_b) {
+    return cos_a > cos_b ? 0 : sin_a * cos_b - cos_a * sin_b;
+}
+
+}
+
+DirectionCone DirectionCone::Union(const DirectionCone& a, const DirectionCone& b) {
+    using namespace light_detail;
+
+    XFloat theta_a = SafeAcos(a.cos_theta);
+    XFloat theta_b = SafeAcos(b.cos_theta);
+    XFloat theta_d = SafeAcos(a.w.Dot(b.w));
+    if (math::Min(theta_d + theta_b, math::kPI) <= theta_a) return a;
+    if (math::Min(theta_d + theta_a, math::kPI) <= theta_b) return b;
+
+    // Smallest cone over both: its edge touches the far edges of a and b
+    XFloat theta_o = (theta_a + theta_d + theta_b) / 2;
+    if (theta_o >= math::kPI) return DirectionCone();
+
+    Vec3f axis = a.w.Cross(b.w);
+    if (axis.MagnitudeSq() < math::kEpsilon * math::kEpsilon) return DirectionCone();
+    Vec3f w = Rotate(a.w, axis.Normalize(), theta_o - theta_a);
+    return DirectionCone(w.Normalize(), std::cos(theta_o));
+}
+
+// Bounds the angle between the normals and the direction to p from below, shrinks it by the
+// angle the box spans from p and drops the lights whose emission cone then misses p
+// (Conty Estevez and Kulla, pbrt-v4). The normal at p is not known, so it is not used.
+XFloat LightBounds::Importance(const Vec3f& p) const {
+    using namespace light_detail;
+    if (phi == 0) return 0;
+
+    Vec3f center = (bounds.min + bounds.max) * 0.5;
+    Vec3f diagonal = bounds.max - bounds.min;
+    XFloat d2 = math::Max((p - center).MagnitudeSq(), diagonal.Magnitude() / 2);
+
+    Vec3f wi = (p - center).Normalize();
+    XFloat cos_w = normals.w.Dot(wi);
+    XFloat sin_w = SafeSqrt(1 - cos_w * cos_w);
+
+    // Half angle of the box seen from p, everything from inside its bounding sphere
+    XFloat radius2 = diagonal.MagnitudeSq() / 4;
+    XFloat dist2 = (p - center).MagnitudeSq();
+    XFloat cos_b = dist2 <= radius2 ? -1 : SafeSqrt(1 - radius2 / dist2);
+    XFloat sin_b = SafeSqrt(1 - cos_b * cos_b);
+
+    XFloat cos_o = normals.cos_theta;
+    XFloat sin_o = SafeSqrt(1 - cos_o * cos_o);
+    XFloat cos_x = CosSubClamped(sin_w, cos_w, sin_o, cos_o);
+    XFloat sin_x = SinSubClamped(sin_w, cos_w, sin_o, cos_o);
+    XFloat cos_p = CosSubClamped(sin_x, cos_x, sin_b, cos_b);
+    if (cos_p <= kCosThetaEmission) return 0;
+
+    return phi * cos_p / d2;
+}
+
+LightBounds LightBounds::Union(const LightBounds& a, const LightBounds& b) {
+    if (a.phi == 0) return b;
+    if (b.phi == 0) return a;
+
+    LightBounds merged;
+    merged.bounds = AABB::Union(a.bounds, b.bounds);
+    merged.phi = a.phi + b.phi;
+    merged.normals = DirectionCone::Union(a.normals, b.normals);
+    return merged;
+}
+
+LightSampler::LightSampler(const std::vector<std::shared_ptr<Hittable>>& lights, LightSampling sampling) :
+    sampling_(sampling)
+{
+    if (lights.empty()) return;
+
+    std::vector<BvhPrimitive> refs(lights.size());
+    for (size_t i = 0; i < lights.size(); ++i) {
+        const AABB& box = lights[i]->bounding_box();
+        refs[i].bounds = box;
+        refs[i].centroid = (box.min + box.max) * 0.5;
+        refs[i].index = static_cast<uint32_t>(i);
+    }
+    tree_.Build(refs, BvhOptions());
+
+    lights_.reserve(refs.size());
+    for (const auto& ref : refs) {
+        lights_.push_back(lights[ref.index]);
+    }
+
+    // Lights without power (black or without area) are never picked
+    std::vector<XFloat> weights(lights_.size());
+    for (size_t i = 0; i < lights_.size(); ++i) {
+        Material* mat = lights_[i]->material();
+        weights[i] = mat ? Luminance(mat->Emission()) * lights_[i]->Area() : 0;
+    }
+
+    if (sampling_ == LightSampling::kPower) {
+        BuildAliasTable(weights);
+    } else {
+        std::vector<std::pair<uint32_t, LightBounds>> bounds(lights_.size());
+        for (size_t i = 0; i < lights_.size(); ++i) {
+            bounds[i].first = static_cast<uint32_t>(i);
+            bounds[i].second.bounds = lights_[i]->bounding_box();
+            bounds[i].second.phi = weights[i];
+            lights_[i]->NormalBounds(bounds[i].second.normals.w, bounds[i].second.normals.cos_theta);
+        }
+
+        trails_.resize(lights_.size());
+        nodes_.reserve(2 * lights_.size() - 1);
+        BuildLightBvh(bounds, 0, bounds.size(), 0, 0);
+    }
+
+    bounding_box_ = refs[0].bounds;
+    for (size_t i = 1; i < refs.size(); ++i) {
+        bounding_box_ = AABB::Union(bounding_box_, refs[i].bounds);
+    }
+}
+
+void LightSampler::BuildAliasTable(const std::vector<XFloat>& weights) {
+    size_t n = weights.size();
+    XFloat total = 0;
+    for (XFloat weight : weights) {
+        total += weight;
+    }
+
+    pmf_.assign(n, 0);
+    if (!(total > 0)) {
+        // No light has power, alias_ stays empty and nothing is sampled
+        return;
+    }
+
+    alias_.resize(n);
+    std::vector<XFloat> scaled(n);
+    std::vector<uint32_t> small, large;
+    for (size_t i = 0; i < n; ++i) {
+        pmf_[i] = weights[i] / total;
+        scaled[i] = pmf_[i] * n;
+        (scaled[i] < 1 ? small : large).push_back(static_cast<uint32_t>(i));
+    }
+
+    // Every small entry is topped up to 1 by a large one, which becomes its alias
+    while (!small.empty() && !large.empty()) {
+        uint32_t s = small.back();
+        small.pop_back();
+        uint32_t l = large.back();
+
+        alias_[s] = { scaled[s], l };
+        scaled[l] -= 1 - scaled[s];
+        if (scaled[l] < 1) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+
+    // Left over entries are 1 up to rounding
+    for (uint32_t i : small) alias_[i] = { 1, i };
+    for (uint32_t i : large) alias_[i] = { 1, i };
+}
+
+// Surface area orientation heuristic: power times the solid angle the emission can reach
+// times the area, boxes thin along the split axis are penalized
+XFloat LightSampler::SaohCost(const LightBounds& b, const AABB& parent, int axis) {
+    XFloat theta_o = light_detail::SafeAcos(b.normals.cos_theta);
+    XFloat theta_e = std::acos(LightBounds::kCosThetaEmission);
+    XFloat theta_w = math::Min(theta_o + theta_e, math::kPI);
+    XFloat sin_o = std::sin(theta_o);
+    XFloat m_omega = 2 * math::kPI * (1 - std::cos(theta_o)) +
+        math::kPI / 2 * (2 * theta_w * sin_o - std::cos(theta_o - 2 * theta_w) - 2 * theta_o * sin_o + std::cos(theta_o));
+
+    Vec3f diagonal = parent.max - parent.min;
+    XFloat longest = math::Max(diagonal.x, math::Max(diagonal.y, diagonal.z));
+    XFloat kr = diagonal[axis] > 0 ? longest / diagonal[axis] : 0;
+    return b.phi * m_omega * kr * b.bounds.Area();
+}
+
+uint32_t LightSampler::BuildLightBvh(std::vector<std::pair<uint32_t, LightBounds>>& lights, size_t start, size_t end,
+    uint64_t trail, int depth)
+{
+    uint32_t node_index = static_cast<uint32_t>(nodes_.size());
+    nodes_.push_back(LightBvhNode());
+
+    if (end - start == 1) {
+        nodes_[node_index] = { lights[start].second, lights[start].first, true };
+        trails_[lights[start].first] = trail;
+        return node_index;
+    }
+
+    AABB bounds = lights[start].second.bounds;
+    AABB centroids(lights[start].second.bounds.min, lights[start].second.bounds.min);
+    for (size_t i = start; i < end; ++i) {
+        const AABB& box = lights[i].second.bounds;
+        Vec3f c = (box.min + box.max) * 0.5;
+        bounds = AABB::Union(bounds, box);
+        centroids = i == start ? AABB(c, c) : AABB::Union(centroids, AABB(c, c));
+    }
+
+    size_t mid = (start + end) / 2;
+    XFloat best_cost = math::kInfinite;
+    int best_axis = -1, best_bucket = -1;
+    if (depth < kMaxSaohDepth) {
+        for (int axis = 0; axis < 3; ++axis) {
+            XFloat extent = centroids.max[axis] - centroids.min[axis];
+            if (extent <= 0) continue;
+
+            LightBounds buckets[kBuckets];
+            for (size_t i = start; i < end; ++i) {
+                const AABB& box = lights[i].second.bounds;
+                XFloat c = (box.min[axis] + box.max[axis]) * 0.5;
+                int b = math::Min(static_cast<int>(kBuckets * (c - centroids.min[axis]) / extent), kBuckets - 1);
+                buckets[b] = LightBounds::Union(buckets[b], lights[i].second);
+            }
+
+            for (int split = 0; split < kBuckets - 1; ++split) {
+                LightBounds below, above;
+                for (int b = 0; b <= split; ++b) below = LightBounds::Union(below, buckets[b]);
+                for (int b = split + 1; b < kBuckets; ++b) above = LightBounds::Union(above, buckets[b]);
+                if (below.phi == 0 || above.phi == 0) continue;
+
+                XFloat cost = SaohCost(below, bounds, axis) + SaohCost(above, bounds, axis);
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_bucket = split;
+                }
+            }
+        }
+    }
+
+    if (best_axis >= 0) {
+        int axis = best_axis;
+        XFloat extent = centroids.max[axis] - centroids.min[axis];
+        auto it = std::partition(lights.begin() + start, lights.begin() + end, [&](const auto& light) {
+            XFloat c = (light.second.bounds.min[axis] + light.second.bounds.max[axis]) * 0.5;
+            int b = math::Min(static_cast<int>(kBuckets * (c - centroids.min[axis]) / extent), kBuckets - 1);
+            return b <= best_bucket;
+        });
+        mid = it - lights.begin();
+    }
+    if (mid == start || mid == end) {
+        // Coincident centroids or the depth limit, halves by count keep the tree balanced
+        mid = (start + end) / 2;
+        int axis = centroids.LongestAxis();
+        std::nth_element(lights.begin() + start, lights.begin() + mid, lights.begin() + end, [axis](const auto& a, const auto& b) {
+            return a.second.bounds.min[axis] + a.second.bounds.max[axis] < b.second.bounds.min[axis] + b.second.bounds.max[axis];
+        });
+    }
+
+    BuildLightBvh(lights, start, mid, trail, depth + 1);
+    uint32_t second = BuildLightBvh(lights, mid, end, trail | (uint64_t(1) << depth), depth + 1);
+
+    LightBounds merged = LightBounds::Union(nodes_[node_index + 1].bounds, nodes_[second].bounds);
+    nodes_[node_index] = { merged, second, false };
+    return node_index;
+}
+
+XFloat LightSampler::Pmf(const Vec3f& p, size_t i) const {
+    if (sampling_ == LightSampling::kPower) return pmf_[i];
+
+    uint64_t trail = trails_[i];
+    uint32_t node = 0;
+    XFloat pmf = 1;
+    while (!nodes_[node].leaf) {
+        uint32_t children[2] = { node + 1, nodes_[node].index };
+        XFloat importance[2] = { nodes_[children[0]].bounds.Importance(p), nodes_[children[1]].bounds.Importance(p) };
+        int branch = static_cast<int>(trail & 1);
+        if (importance[branch] == 0) return 0;
+
+        pmf *= importance[branch] / (importance[0] + importance[1]);
+        node = children[branch];
+        trail >>= 1;
+    }
+    return pmf;
+}
+
+size_t LightSampler::SampleIndex(const Vec3f& p, math::Rand& rng) const {
+    XFloat u = math::random::Random<XFloat>(rng);
+    if (sampling_ == LightSampling::kPower) {
+        if (alias_.empty()) return size();
+
+        u *= alias_.size();
+        size_t i = std::min(static_cast<size_t>(u), alias_.size() - 1);
+        return u - i < alias_[i].probability ? i : alias_[i].alias;
+    }
+
+    uint32_t node = 0;
+    if (nodes_[0].leaf) {
+        return nodes_[0].bounds.Importance(p) > 0 ? nodes_[0].index : size();
+    }
+    while (!nodes_[node].leaf) {
+        uint32_t children[2] = { node + 1, nodes_[node].index };
+        XFloat importance[2] = { nodes_[children[0]].bounds.Importance(p), nodes_[children[1]].bounds.Importance(p) };
+        XFloat sum = importance[0] + importance[1];
+        if (sum == 0) return size();
+
+        // The remainder of u picks the next branch
+        XFloat p0 = importance[0] / sum;
+        if (u < p0) {
+            node = children[0];
+            u = u / p0;
+        } else {
+            node = children[1];
+            u = (u - p0) / (1 - p0);
+        }
+    }
+    return nodes_[node].index;
+}
+
+bool LightSampler::Hit(const Ray& r, XFloat t_min, XFloat t_max, HitResult& rec) const {
+    return tree_.Traverse(r, t_min, t_max, [&](uint32_t i, XFloat t0, XFloat& t1) {
+        if (!lights_[i]->Hit(r, t0, t1, rec)) {
+            return false;
+        }
+        t1 = rec.t;
+        return true;
+    });
+}
+
+XFloat LightSampler::VisiblePDF(const Vec3f& o, const Vec3f& v) const {
+    if (empty()) return 0;
+
+    Ray r(o, v);
+    HitResult rec;
+    size_t nearest = size();
+    tree_.Traverse(r, 0.001, math::kInfinite, [&](uint32_t i, XFloat t0, XFloat& t1) {
+        if (!lights_[i]->Hit(r, t0, t1, rec)) {
+            return false;
+        }
+        t1 = rec.t;
+        nearest = i;
+        return true;
+    });
+    return nearest < size() ? Pmf(o, nearest) * lights_[nearest]->PDF(o, v, rec) : 0;
+}
@@ -15,7 +15,7 @@ struct ScatterRecord {
 
 class Material {
 public:
-    virtual bool Scatter(const Ray& r_in, const HitResult& rec, ScatterRecord& srec) const = 0;
+    virtual bool Scatter(const Ray& r_in, const HitResult& rec, ScatterRecord& srec, math::Rand& rng) const = 0;
     
     virtual XFloat ScatteringPDF(const Ray& r_in, const HitResult& rec, const Ray& scattered) const {
         return 0;
@@ -26,6 +26,8 @@ public:
     }
 
     virtual bool IsLight() const { return false; }
+    // Average emitted radiance
+    virtual Color Emission() const { return Color::zero; }
 
     std::unique_ptr<PDF> pdf_ptr;
 };
@@ -40,7 +42,7 @@ public:
         pdf_ptr = std::make_unique<CosinePDF>();
     }
 
-    bool Scatter(const Ray& r_in, const HitResult& rec, ScatterRecord& srec) const override {
+    bool Scatter(const Ray& r_in, const HitResult& rec, ScatterRecord& srec, math::Rand&) const override {
         srec.is_specular = false;
         srec.attenuation = albedo->Value(rec.uv.u, rec.uv.v, rec.p);
         srec.pdf_ptr = pdf_ptr.get();// std::make_shared<CosinePDF>(rec.normal);
@@ -60,9 +62,9 @@ class Metal : public Material {
 public:
     Metal(const Color& a, XFloat f) : albedo(a), fuzz(f < 1 ? f : 1) {}
 
-    virtual bool Scatter(const Ray& r_in, const HitResult& rec, ScatterRecord& srec) const override {
+    virtual bool Scatter(const Ray& r_in, const HitResult& rec, ScatterRecord& srec, math::Rand& rng) const override {
         Vec3f reflected = Vec3f::Reflect(r_in.direction.Normalize(), rec.normal);
-        srec.specular_ray = Ray(rec.p, reflected + fuzz  * math::random::PointInsideUnitSphere(), r_in.time);
+        srec.specular_ray = Ray(rec.p, reflected + fuzz  * math::random::PointInsideUnitSphere(rng), r_in.time);
         srec.attenuation = albedo;
         srec.is_specular = true;
         srec.pdf_ptr = nullptr;
@@ -78,7 +80,7 @@ class Dielectric : public Material {
 public:
     Dielectric(XFloat index_of_refraction) : ir(index_of_refraction) {}
 
-    virtual bool Scatter(const Ray& r_in, const HitResult& rec, ScatterRecord& srec) const override {
+    virtual bool Scatter(const Ray& r_in, const HitResult& rec, ScatterRecord& srec, math::Rand& rng) const override {
         srec.is_specular = true;
         srec.pdf_ptr = nullptr;
         srec.attenuation = Color(1.0, 1.0, 1.0);
@@ -91,7 +93,7 @@ public:
         bool cannot_refract = refraction_ratio * sin_theta > 1.0;
         Vec3f direction;
 
-        if (cannot_refract || reflectance(cos_theta, refraction_ratio) > math::random::Random<XFloat>())
+        if (cannot_refract || reflectance(cos_theta, refraction_ratio) > math::random::Random<XFloat>(rng))
             direction = Vec3f::Reflect(unit_direction, rec.normal);
         else
             direction = Vec3f::Refract(unit_direction, rec.normal, refraction_ratio);
@@ -117,7 +119,7 @@ public:
     DiffuseLight(std::shared_ptr<Texture> a) : emit(a) {}
     DiffuseLight(Color c) : emit(std::make_shared<SolidColor>(c)) {}
 
-    virtual bool Scatter(const Ray& r_in, const HitResult& rec, ScatterRecord& srec) const override {
+    virtual bool Scatter(const Ray& r_in, const HitResult& rec, ScatterRecord& srec, math::Rand&) const override {
         return false;
     }
 
@@ -128,6 +130,8 @@ public:
     }
 
     virtual bool IsLight() const override { return true; }
+    // Exact for solid colors, textured lights are taken at their center
+    virtual Color Emission() const override { return emit->Value(0.5, 0.5, Vec3f::zero); }
 
 public:
     std::shared_ptr<Texture> emit;
@@ -148,7 +152,7 @@ public:
     //     attenuation = albedo->Value(rec.uv.x, rec.uv.y, rec.p);
     //     return true;
     // }
-    virtual bool Scatter(const Ray& r_in, const HitResult& rec, ScatterRecord& srec) const override {
+    virtual bool Scatter(const Ray& r_in, const HitResult& rec, ScatterRecord& srec, math::Rand&) const override {
         srec.is_specular = false;
         srec.attenuation = albedo->Value(rec.uv.u, rec.uv.v, rec.p);
         srec.pdf_ptr = pdf_ptr.get();//std::make_shared<SphericalPDF>(rec.p);
@@ -1,32 +1,51 @@
 #pragma once
 
 #include <cstdint>
-#include <random>
 
 namespace math {
 
+// splitmix64 finalizer, spreads nearby keys over the whole seed space
+inline uint64_t MixBits(uint64_t v) {
+    v ^= v >> 30;
+    v *= 0xbf58476d1ce4e5b9ULL;
+    v ^= v >> 27;
+    v *= 0x94d049bb133111ebULL;
+    v ^= v >> 31;
+    return v;
+}
+
+// PCG32 (pcg-random.org): 64-bit LCG state with a permuted 32-bit output.
+// Small enough to keep one per render job, streams give independent sequences.
 class Rand {
 public:
-    Rand() : rng_() {}
-
-    void SetSeed(uint32_t sd) {
-        rng_.seed(sd);
+    Rand() { SetSeed(0); }
+    explicit Rand(uint64_t seed, uint64_t stream = 0) { SetSeed(seed, stream); }
+
+    void SetSeed(uint64_t seed, uint64_t stream = 0) {
+        state_ = 0;
+        inc_ = (stream << 1) | 1;
+        Get();
+        state_ += seed;
+        Get();
     }
 
     uint32_t Get() {
-        uint32_t v = rng_();
-        return v;
+        uint64_t old = state_;
+        state_ = old * 6364136223846793005ULL + inc_;
+        uint32_t xorshifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+        uint32_t rot = static_cast<uint32_t>(old >> 59);
+        return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
     }
 
-    // random number between 0.0 and 1.0
+    // random number in [0.0, 1.0)
     float GetFloat() {
-        // take 23 bits of integer, and divide by 2^23-1
-        uint32_t value = Get();
-        return float(value & 0x007FFFFF) * (1.0f / 8388607.0f);
+        // take the top 24 bits, exactly representable in a float
+        return float(Get() >> 8) * (1.0f / 16777216.0f);
     }
 
 private:
-    std::minstd_rand rng_;
+    uint64_t state_;
+    uint64_t inc_;
 };
 
-}
\ No newline at end of file
+}
@@ -10,26 +10,32 @@
 namespace math {
 namespace random {
 
+// Scene setup draws from the global generator. Rendering passes its own Rand
+// through every sampling call, g_rng is not safe to share between threads.
 extern math::Rand g_rng;
 
 inline void SetSeed(uint32_t sd) {
     g_rng.SetSeed(sd);
 }
 
+inline uint32_t Value(Rand& rng) {
+    return rng.Get();
+}
+
 inline uint32_t Value() {
-    return g_rng.Get();
+    return Value(g_rng);
 }
 
-inline int Random(int min, int max) {
+inline int Random(Rand& rng, int min, int max) {
     int dif;
     if (min < max) {
         dif = max - min;
-        int t = g_rng.Get() % dif;
+        int t = rng.Get() % dif;
         t += min;
         return t;
     } else if (min > max) {
         dif = min - max;
-        int t = g_rng.Get() % dif;
+        int t = rng.Get() % dif;
         t = min - t;
         return t;
     } else {
@@ -37,29 +43,51 @@ inline int Random(int min, int max) {
     }        
 }
 
+inline int Random(int min, int max) {
+    return Random(g_rng, min, max);
+}
+
+template<typename T>
+inline T Random(Rand& rng) {
+    return (T)rng.GetFloat();
+}
+
 template<typename T>
 inline T Random() {
-    return (T)g_rng.GetFloat();
+    return Random<T>(g_rng);
 }
 
 template<typename T>
-inline T Random(T min, T max) {
-    T t = Random<T>();
+inline T Random(Rand& rng, T min, T max) {
+    T t = Random<T>(rng);
     t = min * t + (1.0 - t) * max;
     return t;
 }
 
+template<typename T>
+inline T Random(T min, T max) {
+    return Random(g_rng, min, max);
+}
+
+inline Vec3f Vector(Rand& rng) {
+    return Vec3f(Random<XFloat>(rng), Random<XFloat>(rng), Random<XFloat>(rng));
+}
+
 inline Vec3f Vector() {
-    return Vec3f(Random<XFloat>(), Random<XFloat>(), Random<XFloat>());
+    return Vector(g_rng);
+}
+
+inline Vec3f Vector(Rand& rng, XFloat min, XFloat max) {
+    return Vec3f(Random<XFloat>(rng, min, max), Random<XFloat>(rng, min, max), Random<XFloat>(rng, min, max));
 }
 
 inline Vec3f Vector(XFloat min, XFloat max) {
-    return Vec3f(Random<XFloat>(min, max), Random<XFloat>(min, max), Random<XFloat>(min, max));
+    return Vector(g_rng, min, max);
 }
 
-inline Vec3f UnitVector() {
-    XFloat z = Random<XFloat>(-1.0, 1.0);
-    XFloat a = Random<XFloat>(0.0, 2.0 * kPI);
+inline Vec3f UnitVector(Rand& rng) {
+    XFloat z = Random<XFloat>(rng, -1.0, 1.0);
+    XFloat a = Random<XFloat>(rng, 0.0, 2.0 * kPI);
 
     XFloat r = ::sqrt (1.0 - z*z);
 
@@ -69,8 +97,12 @@ inline Vec3f UnitVector() {
     return Vec3f(x, y, z);
 }
 
-inline Vec2f UnitVec2f() {
-    XFloat a = Random<XFloat>(0.0, 2.0 * kPI);
+inline Vec3f UnitVector() {
+    return UnitVector(g_rng);
+}
+
+inline Vec2f UnitVec2f(Rand& rng) {
+    XFloat a = Random<XFloat>(rng, 0.0, 2.0 * kPI);
 
     XFloat x = ::cos(a);
     XFloat y = ::sin(a);
@@ -78,12 +110,16 @@ inline Vec2f UnitVec2f() {
     return Vec2f(x, y);
 }
 
-inline ::Quaternion Quaternion() {
+inline Vec2f UnitVec2f() {
+    return UnitVec2f(g_rng);
+}
+
+inline ::Quaternion Quaternion(Rand& rng) {
     ::Quaternion q;
-    q.x = Random<XFloat>(-1.0, 1.0);
-    q.y = Random<XFloat>(-1.0, 1.0);
-    q.z = Random<XFloat>(-1.0, 1.0);
-    q.w = Random<XFloat>(-1.0, 1.0);
+    q.x = Random<XFloat>(rng, -1.0, 1.0);
+    q.y = Random<XFloat>(rng, -1.0, 1.0);
+    q.z = Random<XFloat>(rng, -1.0, 1.0);
+    q.w = Random<XFloat>(rng, -1.0, 1.0);
     q.Normalized();
     if (q.Dot(Quaternion::identity) < 0.0)
         return -q;
@@ -91,18 +127,30 @@ inline ::Quaternion Quaternion() {
         return q;
 }
 
-inline Vec3f PointInsideUnitSphere() {
-    Vec3f v = UnitVector();
-    v *= Pow(Random<XFloat>(), (XFloat)(1.0 / 3.0));
+inline ::Quaternion Quaternion() {
+    return Quaternion(g_rng);
+}
+
+inline Vec3f PointInsideUnitSphere(Rand& rng) {
+    Vec3f v = UnitVector(rng);
+    v *= Pow(Random<XFloat>(rng), (XFloat)(1.0 / 3.0));
     return v;
 }
 
-inline Vec2f PointInsideUnitCircle() {
-    Vec2f v = UnitVec2f();
+inline Vec3f PointInsideUnitSphere() {
+    return PointInsideUnitSphere(g_rng);
+}
+
+inline Vec2f PointInsideUnitCircle(Rand& rng) {
+    Vec2f v = UnitVec2f(rng);
     // As the volume of the sphere increases (x^3) over an interval we have to increase range as well with x^(1/3)
-    v *= Pow(Random<XFloat>(0.0, 1.0), (XFloat)(1.0 / 2.0));
+    v *= Pow(Random<XFloat>(rng, 0.0, 1.0), (XFloat)(1.0 / 2.0));
     return v;
 }
 
+inline Vec2f PointInsideUnitCircle() {
+    return PointInsideUnitCircle(g_rng);
+}
+
 }
 }
\ No newline at end of file
@@ -0,0 +1,7 @@
+#pragma once
+
+// SSE kernels are used on x86-64 unless the build disables them (RAYTOY_SIMD=OFF)
+#if !defined(RAYTOY_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64))
+#define RAYTOY_SSE 1
+#include <emmintrin.h>
+#endif
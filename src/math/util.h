@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cmath>
+#include <cstdint>
 #include <limits>
 
 #define XFloat double
@@ -115,6 +116,19 @@ namespace math {
     inline float ATan2(float y, float x) {
         return ::atan2(y, x);
     }
+
+    // Interleaves the bits of x and y (16 bits each), x in the even bits
+    inline uint32_t MortonEncode2D(uint32_t x, uint32_t y) {
+        auto spread = [](uint32_t v) {
+            v &= 0x0000ffff;
+            v = (v | (v << 8)) & 0x00ff00ff;
+            v = (v | (v << 4)) & 0x0f0f0f0f;
+            v = (v | (v << 2)) & 0x33333333;
+            v = (v | (v << 1)) & 0x55555555;
+            return v;
+        };
+        return spread(x) | (spread(y) << 1);
+    }
 }
 
 
@@ -4,9 +4,9 @@
 #include "hittable/hittable.h"
 #include "common/ray.h"
 
-inline Vec3f random_cosine_direction() {
-    auto r1 = math::random::Random<XFloat>();
-    auto r2 = math::random::Random<XFloat>();
+inline Vec3f random_cosine_direction(math::Rand& rng) {
+    auto r1 = math::random::Random<XFloat>(rng);
+    auto r2 = math::random::Random<XFloat>(rng);
     auto z = sqrt(1-r2);
 
     auto phi = 2 * math::kPI * r1;
@@ -16,9 +16,9 @@ inline Vec3f random_cosine_direction() {
     return Vec3f(x, y, z);
 }
 
-inline Vec3f random_to_sphere(XFloat radius, XFloat distance_squared) {
-    auto r1 = math::random::Random<XFloat>();
-    auto r2 = math::random::Random<XFloat>();
+inline Vec3f random_to_sphere(math::Rand& rng, XFloat radius, XFloat distance_squared) {
+    auto r1 = math::random::Random<XFloat>(rng);
+    auto r2 = math::random::Random<XFloat>(rng);
     auto z = 1 + r2 * (sqrt(1 - radius * radius / distance_squared) - 1);
 
     auto phi = 2 * math::kPI * r1;
@@ -28,89 +28,62 @@ inline Vec3f random_to_sphere(XFloat radius, XFloat distance_squared) {
     return Vec3f(x, y, z);
 }
 
+// Power heuristic (beta = 2) weight of a sample drawn with pdf f, when the same direction
+// may also be sampled with pdf g
+inline XFloat PowerHeuristic(XFloat f, XFloat g) {
+    XFloat f2 = f * f;
+    XFloat sum = f2 + g * g;
+    return sum > 0 ? f2 / sum : 0;
+}
+
 class PDF  {
 public:
+    // Concrete type of a pdf, lets the renderer call the common ones without the vtable.
+    // A material handing out a kCosine or kSpherical pdf scatters with exactly that
+    // density (Lambertian, Isotropic), the renderer evaluates it in place of ScatteringPDF.
+    enum class Kind { kCosine, kSpherical, kOther };
+
+    PDF(Kind kind = Kind::kOther) : kind_(kind) {}
     virtual ~PDF() {}
 
+    Kind kind() const { return kind_; }
+
     virtual XFloat Value(const HitResult& res, const Vec3f& direction) const = 0;
-    virtual Vec3f Sample(const HitResult& res, XFloat& pdf) const = 0;
+    virtual Vec3f Sample(const HitResult& res, XFloat& pdf, math::Rand& rng) const = 0;
+
+private:
+    Kind kind_;
 };
 
-class CosinePDF : public PDF {
+class CosinePDF final : public PDF {
 public:
-    CosinePDF() { }
+    CosinePDF() : PDF(Kind::kCosine) { }
 
     virtual XFloat Value(const HitResult& res, const Vec3f& direction) const override {
         auto cosine = direction.Dot(res.normal);
         return (cosine <= 0) ? 0 : cosine/math::kPI;
     }
 
-    virtual Vec3f Sample(const HitResult& res, XFloat& pdf) const {
+    virtual Vec3f Sample(const HitResult& res, XFloat& pdf, math::Rand& rng) const {
         ONB uvw;
         uvw.BuildFromW(res.normal);
-        auto wo = uvw.local(random_cosine_direction());
-        pdf = Value(res, wo);
-        return wo;
-    }
-};
-
-class HittablePDF : public PDF {
-public:
-    HittablePDF(std::shared_ptr<Hittable> p) : ptr(p) {}
-
-    virtual XFloat Value(const HitResult& res, const Vec3f& direction) const override {
-        return ptr->PDF(res.p, direction);
-    }
-
-    virtual Vec3f Sample(const HitResult& res, XFloat& pdf) const {
-        auto wo = ptr->Sample(res.p);
+        auto wo = uvw.local(random_cosine_direction(rng));
         pdf = Value(res, wo);
         return wo;
     }
-
-public:
-    std::shared_ptr<Hittable> ptr;
 };
 
-class MixturePDF : public PDF {
-    public:
-        MixturePDF(PDF* p0, PDF* p1) {
-            p[0] = p0;
-            p[1] = p1;
-        }
-
-        virtual XFloat Value(const HitResult& res, const Vec3f& direction) const override {
-            return 0.5 * p[0]->Value(res, direction) + 0.5 * p[1]->Value(res, direction);
-        }
-
-        virtual Vec3f Sample(const HitResult& res, XFloat& pdf) const {
-            Vec3f wo;
-            if (math::random::Random<XFloat>() < 0.5) {
-                wo = p[0]->Sample(res, pdf);
-            } else {
-                wo = p[1]->Sample(res, pdf);;
-            }
-            
-            pdf = Value(res, wo);
-
-            return wo;
-        }
-
-    public:
-        PDF* p[2];
-};
-
-class SphericalPDF : public PDF {
+class SphericalPDF final : public PDF {
 public:
-    SphericalPDF() {}
+    SphericalPDF() : PDF(Kind::kSpherical) {}
 
-    virtual XFloat Value(const HitResult& res, const Vec3f& direction) const override {
+    virtual XFloat Value(const HitResult&, const Vec3f&) const override {
         return 1.0 / (4 * math::kPI);
     }
 
-    virtual Vec3f Sample(const HitResult& res, XFloat& pdf) const {
-        auto r1 = math::random::Random<XFloat>();
-        auto r2 = math::random::Random<XFloat>();
+    virtual Vec3f Sample(const HitResult& res, XFloat& pdf, math::Rand& rng) const {
+        auto r1 = math::random::Random<XFloat>(rng);
+        auto r2 = math::random::Random<XFloat>(rng);
         auto x = cos(2 * math::kPI * r1) * 2 * sqrt(r2 * (1-r2));
         auto y = sin(2 * math::kPI * r1) * 2 * sqrt(r2 * (1-r2));
         auto z = 1 - 2 * r2;
@@ -1,8 +1,16 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <iostream>
 #include <cstdint>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <type_traits>
 #include "common/uncopyable.h"
 #include "math/vec3.h"
 #include "common/buffer.h"
@@ -10,17 +18,59 @@
 #include "hittable/hittable.h"
 #include "hittable/hittable_list.h"
 #include "hittable/bvh.h"
+#include "material.h"
 #include "util.h"
+#include "frame_state.h"
+#include "light_sampler.h"
 #include "concurrent/thread_pool.h"
 
-using FrameBuffer = Buffer<math::Vec3<uint8_t>>;
+enum class TraceMode {
+    kPath,      // every sample traced to completion before the next one
+    kWavefront, // a batch of paths per tile advanced one bounce at a time, shaded per material
+};
+
+enum class ShardMode {
+    kTiles,   // every count-th tile in dispatch order, all samples of their pixels
+    kSamples, // a contiguous range of the samples of every pixel
+};
+
+// Part of a frame rendered by one of several processes, whose frame states are then
+// merged, see shard.h. A single shard is the whole frame.
+struct ShardSpec {
+    // Shard index of count, renders nothing and is rejected outside [0, count)
+    bool Valid() const { return count >= 1 && index >= 0 && index < count; }
+    // A sample split gives every shard at least one sample of every pixel
+    bool Fits(int samples_per_pixel) const { return mode != ShardMode::kSamples || count <= samples_per_pixel; }
+
+    int index = 0;
+    int count = 1;
+    ShardMode mode = ShardMode::kTiles;
+};
 
 struct TraceSpec {
     int width;
     int height;
     int samples_per_pixel;
-    // XFloat rr; //RussianRoulette
     int depth;
+    // Bounces before Russian roulette may end a path, depth or more turns it off
+    int rr_depth;
+    TraceMode mode;
+    LightSampling light_sampling;
+    // Frame seed, every sample of a pixel derives its own stream from it
+    uint64_t seed;
+    // Edge of the square tiles handed to the workers, in pixels
+    int tile_size;
+    // Adaptive sampling, off when the threshold is 0. A tile stops sampling once the
+    // relative standard error of its pixel luminances falls below the threshold, after at
+    // least adaptive_min_samples; the others go on up to samples_per_pixel.
+    XFloat adaptive_threshold;
+    int adaptive_min_samples;
+    // Progressive renders resume from this checkpoint when it belongs to the same frame,
+    // and save to it at most every checkpoint_interval seconds and when they end.
+    // No checkpoints when empty.
+    std::string checkpoint_path;
+    XFloat checkpoint_interval;
+    ShardSpec shard;
     XFloat inv_width;
     XFloat inv_height;
     XFloat inv_samples_per_pixel;
@@ -29,15 +79,39 @@ struct TraceSpec {
     const Camera* camera;
 };
 
-struct RaySpan {
-    RaySpan(int b, int e) : begin(b), end(e) {}
+// Pixel rectangle [x0, x1) x [y0, y1), y counted from the bottom row
+struct RayTile {
+    RayTile(int x0_, int y0_, int x1_, int y1_) : x0(x0_), y0(y0_), x1(x1_), y1(y1_) {}
+
+    int x0, y0;
+    int x1, y1;
+};
+
+// A path being traced: the ray of its next bounce, the product of the BSDF weights so far
+// and the radiance gathered so far
+struct PathState {
+    Ray ray;
+    Color throughput;
+    Color radiance;
+    // Solid angle pdf the BSDF sampled ray with, 0 for camera and specular rays
+    XFloat bsdf_pdf;
+    math::Rand rng;
+};
 
-    int begin;
-    int end;
+// Paths of a wavefront, reused by a worker across tiles
+struct WavefrontBatch {
+    std::vector<PathState> paths;
+    std::vector<HitResult> hits;
+    std::vector<int> active;  // paths still bouncing
+    std::vector<int> shading; // paths hitting something this bounce, sorted by material
 };
 
 class Renderer : private Uncopyable {
 public:
+    static constexpr int kMaxAdaptivePassSamples = 64;
+    // Paths in flight per wavefront
+    static constexpr int kWavefrontSize = 4096;
+
     Renderer(int samples_per_pixel, Color background_color = Color::zero, int depth = 50) : 
         background_color_(background_color), 
         lights_(std::make_shared<HittableList>()) 
@@ -45,27 +119,104 @@ public:
         spec_.samples_per_pixel = samples_per_pixel;
         spec_.inv_samples_per_pixel = 1.0 / samples_per_pixel;
         spec_.depth = depth;
+        spec_.rr_depth = 5;
+        spec_.mode = TraceMode::kPath;
+        spec_.light_sampling = LightSampling::kBvh;
+        spec_.seed = 0;
+        spec_.tile_size = 16;
+        spec_.adaptive_threshold = 0;
+        spec_.adaptive_min_samples = 16;
+        spec_.checkpoint_interval = 60;
     }
 
     TraceSpec& spec() { return spec_; }
-    void BuildWorld(const HittableList& world);
+    void BuildWorld(const HittableList& world, const BvhOptions& options = BvhOptions(), int parallel = 8);
     std::shared_ptr<HittableList> lights() { return lights_; }
 
-    void Render(const Camera& camera, FrameBuffer& image, int parallel = 8, int span=256);
+    void Render(const Camera& camera, FrameBuffer& image, int parallel = 8);
+
+    // Called after each progressive pass with the samples per pixel accumulated so far,
+    // image then holds the tone-mapped snapshot. Returning false stops the render.
+    using PassCallback = std::function<bool(int samples, const FrameBuffer& image)>;
+
+    // Renders in passes of 1, 1, 2, 4, ... samples per pixel up to samples_per_pixel, so
+    // every pass doubles the total. The final image is identical to Render's.
+    void RenderProgressive(const Camera& camera, FrameBuffer& image, const PassCallback& on_pass, int parallel = 8);
+
+    const FrameState& frame_state() const { return frame_; }
 
 private:
-    void CastRay(int begin, int end);
-    Color Trace(const Ray& r, int depth);
+    // False when the frame cannot be rendered, e.g. for an invalid shard
+    bool BeginFrame(const Camera& camera, FrameBuffer& image);
+    // Loads spec_.checkpoint_path into the frame state if it matches the frame,
+    // returns the samples per pixel it already holds
+    int Resume();
+    uint64_t FrameHash() const;
+    // Samples [begin, end) of every pixel traced by this shard
+    void SampleRange(int& begin, int& end) const;
+    void RenderPass(ThreadPool& pool, int parallel, int sample_begin, int sample_end);
+    bool Converged(const RayTile& tile) const;
+    // Drops the converged tiles, returns the number of pixels in converged tiles
+    int UpdateActiveTiles();
+    void CastRay(const RayTile& tile, int sample_begin, int sample_end);
+    void CastRayWavefront(const RayTile& tile, int sample_begin, int sample_end);
+    // Adds the radiance of the paths of pixel (i, j), in sample order
+    void AccumulatePixel(int i, int j, const PathState* paths, int samples);
+    PathState StartPath(int i, int j, int sample) const;
+    Color Trace(PathState& path);
+    // Adds the emission at the hit and scatters the path, false when the path ends there
+    bool Shade(PathState& path, const HitResult& res, int bounce);
+    // Samples the light and the BSDF at a non-specular hit, false when the path ends there
+    bool ScatterDiffuse(PathState& path, const HitResult& res, const ScatterRecord& srec, int bounce);
+    // Same with the BSDF pdf of srec as its concrete type, so its calls inline
+    template<typename P>
+    bool ScatterDiffuse(PathState& path, const HitResult& res, const ScatterRecord& srec, const P& bsdf, int bounce);
+    // Next event estimation: adds the light reaching the hit through a shadow ray to a sampled light
+    template<typename P>
+    void SampleLight(PathState& path, const HitResult& res, const ScatterRecord& srec, const P& bsdf) const;
+    // Scattering pdf of the material at res, cosine and spherical pdfs are their material's
+    // (see PDF::Kind) and answer it without the vtable
+    template<typename P>
+    static XFloat ScatteringPDF(const P& bsdf, const Ray& r_in, const HitResult& res, const Ray& scattered);
+    // MIS weight of emission found by the ray of path
+    XFloat EmissionWeight(const PathState& path) const;
+    math::Rand SampleRng(int pixel, int sample) const;
 
     Color background_color_;
     TraceSpec spec_;
-    std::shared_ptr<BvhNode> root_;
+    std::shared_ptr<Bvh> root_;
+    XFloat build_time_ = 0;
+    uint64_t scene_hash_ = 0;
     std::mutex mutex_;
+    std::condition_variable finished_;
     std::shared_ptr<HittableList> lights_;
+    // Built from the emitters of lights_ when a frame begins, lights may be added after BuildWorld
+    std::shared_ptr<LightSampler> light_sampler_;
+    std::vector<RayTile> tiles_;
+    FrameState frame_;
 };
 
-void Renderer::BuildWorld(const HittableList& world) {
-    root_ = std::make_shared<BvhNode>(world.objects, 0, world.objects.size());
+void Renderer::BuildWorld(const HittableList& world, const BvhOptions& options, int parallel) {
+    ThreadPool pool(parallel);
+    root_ = std::make_shared<Bvh>(world.objects, options, &pool);
+    build_time_ = root_->build_time();
+    BvhStats stats = root_->Stats();
+    std::cout << "Scene BVH: " << stats << ", built in " << build_time_ << "s" << std::endl;
+
+    // Identifies the scene in checkpoints: the tree shape and the bounds of every object
+    const AABB& bounds = root_->bounding_box();
+    std::vector<XFloat> values = { static_cast<XFloat>(world.objects.size()), static_cast<XFloat>(stats.nodes),
+        static_cast<XFloat>(stats.leaves), stats.sah_cost, bounds.min.x, bounds.min.y, bounds.min.z, bounds.max.x, bounds.max.y, bounds.max.z };
+    for (const auto& object : world.objects) {
+        const AABB& box = object->bounding_box();
+        values.insert(values.end(), { box.min.x, box.min.y, box.min.z, box.max.x, box.max.y, box.max.z });
+    }
+    scene_hash_ = 0;
+    for (XFloat value : values) {
+        uint64_t bits = 0;
+        std::memcpy(&bits, &value, sizeof(value));
+        scene_hash_ = math::MixBits(scene_hash_ ^ bits);
+    }
 
     std::vector<std::shared_ptr<Hittable>> lights;
     root_->FetchLight(lights);
@@ -75,68 +226,297 @@ void Renderer::BuildWorld(const HittableList& world) {
     }
 }
 
-Color Renderer::Trace(const Ray& r, int depth) {
-    HitResult res;
+// Direct light is sampled twice at diffuse hits, once through a shadow ray to a light and
+// once by the BSDF ray hitting an emitter. Both are weighted with the power heuristic, so
+// each covers the directions it samples well: the light for small lights, the BSDF for
+// glossy surfaces and large lights.
+//
+// Past rr_depth bounces a path survives with a probability following its throughput and
+// the survivors are reweighted, which keeps the estimate unbiased.
+bool Renderer::Shade(PathState& path, const HitResult& res, int bounce) {
+    ScatterRecord srec;
+    Color emitted = res.mat_ptr->Emitted(path.ray, res, res.uv.u, res.uv.v, res.p);
+    if (emitted != Color::zero) {
+        path.radiance += path.throughput * emitted * EmissionWeight(path);
+    }
 
-    if (depth < 0)
-        return Color(0, 0, 0);
+    if (!res.mat_ptr->Scatter(path.ray, res, srec, path.rng))
+        return false;
 
-    if (!root_->Hit(r, 0.001, math::kInfinite, res)) {
-        return background_color_;
+    if (srec.is_specular) {
+        path.throughput *= srec.attenuation;
+        path.ray = srec.specular_ray;
+        path.bsdf_pdf = 0;
+    } else if (!ScatterDiffuse(path, res, srec, bounce)) {
+        return false;
     }
 
-    ScatterRecord srec;
-    Color emitted = res.mat_ptr->Emitted(r, res, res.uv.u, res.uv.v, res.p);
+    if (bounce >= spec_.rr_depth) {
+        const Color& t = path.throughput;
+        XFloat survival = math::Min(math::Max(t.r, math::Max(t.g, t.b)), XFloat(1));
+        // Also ends paths whose throughput went NaN
+        if (!(math::random::Random<XFloat>(path.rng) < survival))
+            return false;
+        path.throughput /= survival;
+    }
+    return true;
+}
 
-    if (!res.mat_ptr->Scatter(r, res, srec))
-        return emitted;
+// Lambertian and isotropic pdfs are the common case and are called directly, the rest
+// goes through the vtable
+bool Renderer::ScatterDiffuse(PathState& path, const HitResult& res, const ScatterRecord& srec, int bounce) {
+    switch (srec.pdf_ptr->kind()) {
+    case PDF::Kind::kCosine:
+        return ScatterDiffuse(path, res, srec, static_cast<const CosinePDF&>(*srec.pdf_ptr), bounce);
+    case PDF::Kind::kSpherical:
+        return ScatterDiffuse(path, res, srec, static_cast<const SphericalPDF&>(*srec.pdf_ptr), bounce);
+    default:
+        return ScatterDiffuse(path, res, srec, *srec.pdf_ptr, bounce);
+    }
+}
 
-    if (srec.is_specular) {
-        return srec.attenuation * Trace(srec.specular_ray, depth - 1);
+template<typename P>
+bool Renderer::ScatterDiffuse(PathState& path, const HitResult& res, const ScatterRecord& srec, const P& bsdf, int bounce) {
+    // The emission found past the last bounce is not gathered, neither is its light sample
+    if (bounce < spec_.depth && !light_sampler_->empty()) {
+        SampleLight(path, res, srec, bsdf);
     }
 
-    if (lights_) {
-        HittablePDF light_ptr(lights_);
-        MixturePDF mp(&light_ptr, srec.pdf_ptr);
-        XFloat pdf_val;
-        auto wo = mp.Sample(res, pdf_val);
-        Ray scattered(res.p, wo, r.time);
+    XFloat pdf_val;
+    Vec3f wo = bsdf.Sample(res, pdf_val, path.rng);
+    if (!(pdf_val > 0))
+        return false;
 
-        return emitted +
-            srec.attenuation * res.mat_ptr->ScatteringPDF(r, res, scattered) * Trace(scattered, depth - 1) / pdf_val;
+    Ray scattered(res.p, wo, path.ray.time);
+    path.throughput *= srec.attenuation * (ScatteringPDF(bsdf, path.ray, res, scattered) / pdf_val);
+    path.ray = scattered;
+    path.bsdf_pdf = pdf_val;
+    return true;
+}
+
+template<typename P>
+void Renderer::SampleLight(PathState& path, const HitResult& res, const ScatterRecord& srec, const P& bsdf) const {
+    size_t index = light_sampler_->SampleIndex(res.p, path.rng);
+    if (index >= light_sampler_->size())
+        return; // no light reaches the point
+    const Hittable& light = *light_sampler_->light(index);
+
+    Ray shadow(res.p, light.Sample(res.p, path.rng), path.ray.time);
+    XFloat scattering = ScatteringPDF(bsdf, path.ray, res, shadow);
+    if (!(scattering > 0))
+        return;
+
+    HitResult light_res;
+    if (!light.Hit(shadow, 0.001, math::kInfinite, light_res))
+        return;
+    Color emitted = light_res.mat_ptr->Emitted(shadow, light_res, light_res.uv.u, light_res.uv.v, light_res.p);
+    if (emitted == Color::zero)
+        return;
+    XFloat light_pdf = light_sampler_->Pmf(res.p, index) * light.PDF(res.p, shadow.direction, light_res);
+    if (!(light_pdf > 0))
+        return;
+
+    // Anything in front of the light hides it, other lights too, which keeps light_pdf the
+    // density of the light the direction sees (VisiblePDF)
+    if (root_->Occluded(shadow, 0.001, light_res.t - 0.001))
+        return;
+
+    XFloat weight = PowerHeuristic(light_pdf, bsdf.Value(res, shadow.direction));
+    path.radiance += path.throughput * srec.attenuation * emitted * (scattering * weight / light_pdf);
+}
+
+template<typename P>
+XFloat Renderer::ScatteringPDF(const P& bsdf, const Ray& r_in, const HitResult& res, const Ray& scattered) {
+    if constexpr (std::is_same_v<P, CosinePDF> || std::is_same_v<P, SphericalPDF>) {
+        return bsdf.Value(res, scattered.direction);
     } else {
-        XFloat pdf_val;
-        auto wo = srec.pdf_ptr->Sample(res, pdf_val);
-        Ray scattered(res.p, wo, r.time);
+        return res.mat_ptr->ScatteringPDF(r_in, res, scattered);
+    }
+}
+
+XFloat Renderer::EmissionWeight(const PathState& path) const {
+    if (path.bsdf_pdf == 0 || light_sampler_->empty())
+        return 1;
+    return PowerHeuristic(path.bsdf_pdf, light_sampler_->VisiblePDF(path.ray.origin, path.ray.direction));
+}
 
-        return emitted + 
-            srec.attenuation * res.mat_ptr->ScatteringPDF(r, res, scattered) * Trace(scattered, depth - 1) / pdf_val;
+Color Renderer::Trace(PathState& path) {
+    for (int bounce = 0; bounce <= spec_.depth; ++bounce) {
+        HitResult res;
+        if (!root_->Hit(path.ray, 0.001, math::kInfinite, res)) {
+            path.radiance += path.throughput * background_color_;
+            break;
+        }
+
+        if (!Shade(path, res, bounce))
+            break;
     }
+
+    return path.radiance;
 }
 
-void Renderer::CastRay(int begin, int end) {
-    for (int x = begin; x <= end; ++x) {
-        int j = x / spec_.width;
-        int i = x - j * spec_.width;
+// Counter-based seeding: the stream of a sample is a hash of the frame seed and the
+// pixel, selected by the sample index. The image is the same for any thread count or
+// tile size, and any subset of pixels renders exactly as in the full frame.
+math::Rand Renderer::SampleRng(int pixel, int sample) const {
+    return math::Rand(math::MixBits(spec_.seed ^ math::MixBits(static_cast<uint64_t>(pixel))), static_cast<uint64_t>(sample));
+}
+
+PathState Renderer::StartPath(int i, int j, int sample) const {
+    PathState path;
+    path.rng = SampleRng(j * spec_.width + i, sample);
+    auto u = (i + math::random::Random<XFloat>(path.rng)) * spec_.inv_width;
+    auto v = (j + math::random::Random<XFloat>(path.rng)) * spec_.inv_height;
+    path.ray = spec_.camera->CastRay(u, v, path.rng);
+    path.throughput = Color::one;
+    path.radiance = Color::zero;
+    path.bsdf_pdf = 0;
+    return path;
+}
 
-        Color pixel_color(0,0,0);
-        for (int s = 0; s < spec_.samples_per_pixel; ++s) {
-            auto u = (i + math::random::Random<XFloat>()) * spec_.inv_width;
-            auto v = (j + math::random::Random<XFloat>()) * spec_.inv_height;
-            Ray r = spec_.camera->CastRay(u, v);
-            
-            Color color = Trace(r, spec_.depth);
-            CanoicalColor(color);
+// Adds the samples one by one like CastRay, so the sums do not depend on the batches
+void Renderer::AccumulatePixel(int i, int j, const PathState* paths, int samples) {
+    int x = j * spec_.width + i;
 
-            pixel_color += color;
+    PixelVariance& variance = frame_.variance.data()[x];
+    Color pixel_color = frame_.sums.data()[x];
+    for (int s = 0; s < samples; ++s) {
+        Color color = paths[s].radiance;
+        CanoicalColor(color);
+
+        pixel_color += color;
+        variance.Add(Luminance(color));
+    }
+
+    frame_.sums.data()[x] = pixel_color;
+    if (variance.count > 0) {
+        spec_.image->Set(i, (spec_.height - 1) - j, SdrColor(pixel_color, 1.0 / variance.count));
+    }
+}
+
+// Adds samples [sample_begin, sample_end) of every pixel to the accumulation buffer
+// one by one, so the sums do not depend on how the samples are split into passes.
+void Renderer::CastRay(const RayTile& tile, int sample_begin, int sample_end) {
+    for (int j = tile.y0; j < tile.y1; ++j) {
+        for (int i = tile.x0; i < tile.x1; ++i) {
+            int x = j * spec_.width + i;
+
+            PixelVariance& variance = frame_.variance.data()[x];
+            Color pixel_color = frame_.sums.data()[x];
+            for (int s = sample_begin; s < sample_end; ++s) {
+                PathState path = StartPath(i, j, s);
+                Color color = Trace(path);
+                CanoicalColor(color);
+
+                pixel_color += color;
+                variance.Add(Luminance(color));
+            }
+
+            frame_.sums.data()[x] = pixel_color;
+            if (variance.count > 0) {
+                spec_.image->Set(i, (spec_.height - 1) - j, SdrColor(pixel_color, 1.0 / variance.count));
+            }
         }
+    }
+}
 
-        spec_.image->Set(i, (spec_.height - 1) - j, SdrColor(pixel_color, spec_.inv_samples_per_pixel));
+// Same samples as CastRay, but the paths of a tile advance together: the whole wavefront
+// is intersected, then the hits are sorted by material and shaded in runs, so each stage
+// keeps its own code and data (BVH nodes, one material and its textures) in cache.
+// Shadow rays are still traced by the shading stage, as they were sampled there.
+// Every path has its own RNG stream, so the image is identical to CastRay's.
+void Renderer::CastRayWavefront(const RayTile& tile, int sample_begin, int sample_end) {
+    thread_local WavefrontBatch batch;
+
+    int tile_width = tile.x1 - tile.x0;
+    int pixels = tile_width * (tile.y1 - tile.y0);
+    int batch_samples = std::max(1, kWavefrontSize / pixels);
+
+    for (int s0 = sample_begin; s0 < sample_end; s0 += batch_samples) {
+        int samples = std::min(batch_samples, sample_end - s0);
+
+        // Path p * samples + s is sample s0 + s of pixel p of the tile
+        batch.paths.resize(pixels * samples);
+        batch.hits.resize(pixels * samples);
+        batch.active.clear();
+        for (int p = 0; p < pixels; ++p) {
+            int i = tile.x0 + p % tile_width;
+            int j = tile.y0 + p / tile_width;
+            for (int s = 0; s < samples; ++s) {
+                batch.paths[p * samples + s] = StartPath(i, j, s0 + s);
+                batch.active.push_back(p * samples + s);
+            }
+        }
+
+        for (int bounce = 0; bounce <= spec_.depth && !batch.active.empty(); ++bounce) {
+            batch.shading.clear();
+            for (int index : batch.active) {
+                PathState& path = batch.paths[index];
+                if (root_->Hit(path.ray, 0.001, math::kInfinite, batch.hits[index])) {
+                    batch.shading.push_back(index);
+                } else {
+                    path.radiance += path.throughput * background_color_;
+                }
+            }
+
+            std::sort(batch.shading.begin(), batch.shading.end(), [&](int a, int b) {
+                return std::less<Material*>()(batch.hits[a].mat_ptr, batch.hits[b].mat_ptr);
+            });
+
+            batch.active.clear();
+            for (int index : batch.shading) {
+                if (Shade(batch.paths[index], batch.hits[index], bounce)) {
+                    batch.active.push_back(index);
+                }
+            }
+        }
+
+        for (int p = 0; p < pixels; ++p) {
+            AccumulatePixel(tile.x0 + p % tile_width, tile.y0 + p / tile_width, &batch.paths[p * samples], samples);
+        }
     }
 }
 
-void Renderer::Render(const Camera& camera, FrameBuffer& image, int parallel, int span) {
-    auto begin = std::chrono::steady_clock::now();
+// Convergence is decided per tile: a pixel whose first samples all missed a rare light
+// path has zero variance and would stop early, its neighbors in the tile did not miss it.
+// The tile error is the RMS of the relative errors of its pixels.
+bool Renderer::Converged(const RayTile& tile) const {
+    XFloat sum = 0;
+    for (int j = tile.y0; j < tile.y1; ++j) {
+        for (int i = tile.x0; i < tile.x1; ++i) {
+            const PixelVariance& pixel = frame_.variance.data()[j * spec_.width + i];
+            if (pixel.count < spec_.adaptive_min_samples) return false;
+
+            XFloat error = pixel.RelativeError();
+            sum += error * error;
+        }
+    }
+
+    int pixels = (tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+    return std::sqrt(sum / pixels) < spec_.adaptive_threshold;
+}
+
+int Renderer::UpdateActiveTiles() {
+    tiles_.erase(std::remove_if(tiles_.begin(), tiles_.end(), [this](const RayTile& tile) { return Converged(tile); }),
+        tiles_.end());
+
+    int active = 0;
+    for (const auto& tile : tiles_) {
+        active += (tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+    }
+    return spec_.width * spec_.height - active;
+}
+
+bool Renderer::BeginFrame(const Camera& camera, FrameBuffer& image) {
+    if (!spec_.shard.Valid()) {
+        std::cerr << "Invalid shard " << spec_.shard.index << " of " << spec_.shard.count << std::endl;
+        return false;
+    }
+    if (!spec_.shard.Fits(spec_.samples_per_pixel)) {
+        std::cerr << "Cannot split " << spec_.samples_per_pixel << " samples per pixel into " << spec_.shard.count
+            << " shards" << std::endl;
+        return false;
+    }
 
     int width = image.width();
     int height = image.height();
@@ -148,46 +528,235 @@ void Renderer::Render(const Camera& camera, FrameBuffer& image, int parallel, in
     spec_.image = &image;
     spec_.camera = &camera;
 
-    int total = width * height;
-    int count = total / span;
-    std::vector<RaySpan> jobs;
-    jobs.reserve(count + 1);
-    for (int i = 0; i < count;  ++i) {
-        jobs.emplace_back(i * span, i * span + span - 1);
+    int sample_begin, sample_end;
+    SampleRange(sample_begin, sample_end);
+    frame_.Reset(width, height, spec_.seed, FrameHash());
+
+    // Only emitters can be seen by shadow rays, other objects in lights_ would waste the samples.
+    // Without light sampling the sampler stays empty and emission is weighted 1.
+    std::vector<std::shared_ptr<Hittable>> emitters;
+    if (spec_.light_sampling != LightSampling::kNone) {
+        for (const auto& light : lights_->objects) {
+            if (light->material() && light->material()->IsLight()) {
+                emitters.push_back(light);
+            }
+        }
+    }
+    light_sampler_ = std::make_shared<LightSampler>(emitters, spec_.light_sampling);
+    frame_.sample_begin = sample_begin;
+    frame_.shard_mode = static_cast<uint32_t>(spec_.shard.mode);
+    frame_.shard_count = static_cast<uint32_t>(spec_.shard.count);
+    frame_.shards.assign(1, static_cast<uint32_t>(spec_.shard.index));
+
+    // Square tiles keep the rays of a job close together on screen and thus in the BVH.
+    // They are dispatched in Morton order so that concurrently traced tiles are neighbors too.
+    int tile_size = spec_.tile_size;
+    int tiles_x = (width + tile_size - 1) / tile_size;
+    int tiles_y = (height + tile_size - 1) / tile_size;
+
+    std::vector<std::pair<uint32_t, RayTile>> order;
+    order.reserve(tiles_x * tiles_y);
+    for (int ty = 0; ty < tiles_y; ++ty) {
+        for (int tx = 0; tx < tiles_x; ++tx) {
+            int x0 = tx * tile_size;
+            int y0 = ty * tile_size;
+            order.emplace_back(math::MortonEncode2D(tx, ty),
+                RayTile(x0, y0, std::min(x0 + tile_size, width), std::min(y0 + tile_size, height)));
+        }
+    }
+    std::sort(order.begin(), order.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    // Interleaved tile shards get neighboring tiles, so their costs stay close
+    const ShardSpec& shard = spec_.shard;
+    tiles_.clear();
+    tiles_.reserve(order.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        if (shard.mode != ShardMode::kTiles || static_cast<int>(i % shard.count) == shard.index) {
+            tiles_.push_back(order[i].second);
+        }
     }
 
-    if (count * span < total) {
-        jobs.emplace_back(count * span, total - 1); 
+    std::cout << "Total number of jobs: " << tiles_.size() << ", lights: " << light_sampler_->size() << std::endl;
+    return true;
+}
+
+void Renderer::SampleRange(int& begin, int& end) const {
+    const ShardSpec& shard = spec_.shard;
+    begin = 0;
+    end = spec_.samples_per_pixel;
+    if (shard.mode == ShardMode::kSamples) {
+        begin = static_cast<int>(static_cast<long long>(spec_.samples_per_pixel) * shard.index / shard.count);
+        end = static_cast<int>(static_cast<long long>(spec_.samples_per_pixel) * (shard.index + 1) / shard.count);
     }
+}
 
-    std::cout << "Total number of jobs: " << count << std::endl;
+// The scene, the camera, the light emission plus the render settings that change what a
+// sample traces or which samples make up the frame, so a checkpoint or shard of other
+// settings is never mixed in. The trace mode is left out, both modes trace the same samples.
+uint64_t Renderer::FrameHash() const {
+    std::vector<XFloat> values = { static_cast<XFloat>(spec_.depth), static_cast<XFloat>(spec_.rr_depth),
+        static_cast<XFloat>(spec_.samples_per_pixel), static_cast<XFloat>(spec_.light_sampling),
+        background_color_.r, background_color_.g, background_color_.b };
+    // Recoloring a light keeps the scene bounds, its emission and area give it away
+    for (const auto& light : lights_->objects) {
+        Color emission = light->material() ? light->material()->Emission() : Color::zero;
+        values.insert(values.end(), { emission.r, emission.g, emission.b, light->Area() });
+    }
+    uint64_t hash = math::MixBits(math::MixBits(scene_hash_ ^ spec_.seed) ^ spec_.camera->Hash());
+    for (XFloat value : values) {
+        uint64_t bits = 0;
+        std::memcpy(&bits, &value, sizeof(value));
+        hash = math::MixBits(hash ^ bits);
+    }
+    return hash;
+}
+
+int Renderer::Resume() {
+    FrameState saved;
+    if (!saved.Load(spec_.checkpoint_path)) {
+        return 0;
+    }
+    if (!saved.Compatible(frame_) || saved.sample_begin != frame_.sample_begin || saved.shards != frame_.shards) {
+        std::cerr << "Checkpoint " << spec_.checkpoint_path << " belongs to another frame, starting over" << std::endl;
+        return 0;
+    }
+
+    frame_.sums.Swap(saved.sums);
+    frame_.variance.Swap(saved.variance);
+    frame_.Resolve(*spec_.image);
+
+    // Saved between passes: the tiles still sampling all hold the most samples
+    int samples = frame_.MaxSamples();
+    std::cerr << "Resumed " << spec_.checkpoint_path << " at " << samples << " spp" << std::endl;
+    return samples;
+}
+
+void Renderer::RenderPass(ThreadPool& pool, int parallel, int sample_begin, int sample_end) {
+    int job_count = static_cast<int>(tiles_.size());
+
+    // Workers claim tiles with one atomic increment, the list itself is never modified
+    std::atomic<int> next_job(0);
+    std::atomic<int> done_jobs(0);
+    // The counters live on this stack, so the pass waits for the workers, not the tiles
+    std::atomic<int> running(parallel);
 
-    ThreadPool pool(parallel);
     for (int i = 0; i < parallel; ++i) {
-        pool.Enqueue([=, &jobs] {
+        pool.Enqueue([&, job_count, sample_begin, sample_end] {
             while(true) {
-                int begin = -1;
-                int end = -1;
-                {
-                    std::lock_guard<std::mutex> lk(mutex_);
-                    if (jobs.empty()) {
-                        return;
-                    }
-                    auto rs = jobs.back();
-                    begin = rs.begin;
-                    end = rs.end;
-                    jobs.pop_back();
-                    std::cerr << jobs.size() << "      \r";
+                int index = next_job.fetch_add(1, std::memory_order_relaxed);
+                if (index >= job_count) {
+                    break;
+                }
+
+                if (spec_.mode == TraceMode::kWavefront) {
+                    CastRayWavefront(tiles_[index], sample_begin, sample_end);
+                } else {
+                    CastRay(tiles_[index], sample_begin, sample_end);
                 }
-                CastRay(begin, end);
+                done_jobs.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            if (running.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                std::lock_guard<std::mutex> lk(mutex_);
+                finished_.notify_all();
             }
         });
     }
 
+    // Progress is printed from this thread so workers never wait on the console
+    std::unique_lock<std::mutex> lk(mutex_);
+    while (!finished_.wait_for(lk, std::chrono::milliseconds(100),
+        [&] { return running.load(std::memory_order_acquire) == 0; })) {
+        std::cerr << job_count - done_jobs.load(std::memory_order_relaxed) << "      \r";
+    }
+}
+
+void Renderer::Render(const Camera& camera, FrameBuffer& image, int parallel) {
+    // Convergence and checkpoints are only handled between passes
+    if (spec_.adaptive_threshold > 0 || !spec_.checkpoint_path.empty()) {
+        RenderProgressive(camera, image, nullptr, parallel);
+        return;
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+
+    if (!BeginFrame(camera, image))
+        return;
+
+    int sample_begin, sample_end;
+    SampleRange(sample_begin, sample_end);
+
+    ThreadPool pool(parallel);
+    RenderPass(pool, parallel, sample_begin, sample_end);
     pool.Join();
     
     auto end = std::chrono::steady_clock::now();
     std::chrono::duration<double> diff = end - begin;
-    std::cerr << "Finish in " << diff.count() << "s" << std::endl;
+    std::cerr << "Finish in " << diff.count() << "s (BVH build " << build_time_ << "s)" << std::endl;
+}
+
+void Renderer::RenderProgressive(const Camera& camera, FrameBuffer& image, const PassCallback& on_pass, int parallel) {
+    auto begin = std::chrono::steady_clock::now();
+
+    if (!BeginFrame(camera, image))
+        return;
+
+    bool adaptive = spec_.adaptive_threshold > 0;
+    bool checkpoint = !spec_.checkpoint_path.empty();
+
+    int sample_begin, sample_end;
+    SampleRange(sample_begin, sample_end);
+
+    // Samples are seeded by their index, so a resumed render goes on exactly as if it never stopped.
+    // samples counts from the first sample of the shard.
+    int samples = checkpoint ? Resume() : 0;
+    if (adaptive && samples > 0) {
+        UpdateActiveTiles();
+    }
+    int total = sample_end - sample_begin;
+
+    ThreadPool pool(parallel);
+    auto last_save = std::chrono::steady_clock::now();
+    bool saved = true;
+    while (samples < total && !tiles_.empty()) {
+        // Adaptive passes stay short so converged pixels stop soon after they converge
+        int step = samples > 0 ? samples : 1;
+        if (adaptive) step = std::min(step, kMaxAdaptivePassSamples);
+
+        int pass_end = std::min(samples + step, total);
+        RenderPass(pool, parallel, sample_begin + samples, sample_begin + pass_end);
+        samples = pass_end;
+        saved = false;
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+        std::cerr << "Pass done: " << samples << " spp in " << elapsed.count() << "s";
+        if (adaptive) {
+            std::cerr << ", " << UpdateActiveTiles() << "/" << spec_.width * spec_.height << " pixels converged";
+        }
+        std::cerr << std::endl;
+
+        if (checkpoint) {
+            std::chrono::duration<double> since_save = std::chrono::steady_clock::now() - last_save;
+            if (since_save.count() >= spec_.checkpoint_interval) {
+                saved = frame_.Save(spec_.checkpoint_path);
+                last_save = std::chrono::steady_clock::now();
+            }
+        }
+
+        if (on_pass && !on_pass(samples, image)) {
+            break;
+        }
+    }
+    pool.Join();
+
+    if (checkpoint && !saved) {
+        frame_.Save(spec_.checkpoint_path);
+    }
+
+    long long total_samples = frame_.TotalSamples();
+
+    auto end = std::chrono::steady_clock::now();
+    std::chrono::duration<double> diff = end - begin;
+    std::cerr << "Finish in " << diff.count() << "s, " << static_cast<double>(total_samples) / frame_.variance.size()
+        << " spp on average (BVH build " << build_time_ << "s)" << std::endl;
 }
- 
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "frame_state.h"
+#include "renderer.h"
+
+// Multi-process rendering over a shared directory. Every worker process renders one
+// shard of the frame and saves its frame state to ShardPath when done, the coordinator
+// waits for the files and merges them. Saves go through a rename, so a file that shows
+// up is complete. Workers checkpoint next to it and resume when restarted.
+
+inline const char* ShardModeName(ShardMode mode) {
+    return mode == ShardMode::kSamples ? "samples" : "tiles";
+}
+
+// The split is part of the name, shards of a tile split and a sample split never mix
+inline std::string ShardPath(const std::string& dir, const ShardSpec& shard) {
+    return (std::filesystem::path(dir) / ("shard-" + std::to_string(shard.index) + "-of-" +
+        std::to_string(shard.count) + "-" + ShardModeName(shard.mode) + ".state")).string();
+}
+
+// Removes the finished shards of a split left by an earlier run, so the coordinator waits
+// for the new ones. Checkpoints stay, they only resume into a frame they match.
+inline void RemoveShards(const std::string& dir, int count, ShardMode mode) {
+    for (int i = 0; i < count; ++i) {
+        std::filesystem::remove(ShardPath(dir, ShardSpec{ i, count, mode }));
+    }
+}
+
+// Renders shard of the frame into dir, image gets the shard's pixels only
+inline bool RenderShard(Renderer& r, const Camera& camera, FrameBuffer& image, const std::string& dir,
+    const ShardSpec& shard, int parallel = 8)
+{
+    if (!shard.Valid()) {
+        std::cerr << "Invalid shard " << shard.index << " of " << shard.count << std::endl;
+        return false;
+    }
+    if (!shard.Fits(r.spec().samples_per_pixel)) {
+        std::cerr << "Cannot split " << r.spec().samples_per_pixel << " samples per pixel into " << shard.count
+            << " shards" << std::endl;
+        return false;
+    }
+
+    std::filesystem::create_directories(dir);
+    std::string path = ShardPath(dir, shard);
+
+    r.spec().shard = shard;
+    r.spec().checkpoint_path = path + ".ckpt";
+    r.Render(camera, image, parallel);
+
+    if (!r.frame_state().Save(path)) {
+        return false;
+    }
+    std::filesystem::remove(r.spec().checkpoint_path);
+    return true;
+}
+
+// Merges the frame states at paths into merged, false if one is missing, does not belong to
+// the frame or holds a shard another one holds too. split_mode, when given, gets the shard
+// mode of the inputs, merged forgets it once they make up the whole frame.
+inline bool MergeFrameStates(const std::vector<std::string>& paths, FrameState& merged, uint32_t* split_mode = nullptr) {
+    for (size_t i = 0; i < paths.size(); ++i) {
+        FrameState state;
+        if (!state.Load(paths[i])) {
+            std::cerr << "Cannot load " << paths[i] << std::endl;
+            return false;
+        }
+
+        if (i == 0) {
+            merged.Reset(state.width(), state.height(), state.seed, state.scene_hash);
+            merged.sample_begin = state.sample_begin;
+            merged.shard_mode = state.shard_mode;
+            merged.shard_count = state.shard_count;
+            if (split_mode) *split_mode = state.shard_mode;
+        }
+        if (!merged.Merge(state)) {
+            return false;
+        }
+    }
+    return !paths.empty();
+}
+
+// Waits for the count shards of a frame split by mode to show up in dir, then merges them.
+// Gives up after timeout_s seconds, never when it is negative.
+inline bool WaitForShards(const std::string& dir, int count, ShardMode mode, FrameState& merged, int timeout_s = -1) {
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<std::string> paths(count);
+    int remaining = count;
+
+    while (true) {
+        for (int i = 0; i < count; ++i) {
+            if (!paths[i].empty()) continue;
+
+            std::string path = ShardPath(dir, ShardSpec{ i, count, mode });
+            if (std::filesystem::exists(path)) {
+                paths[i] = path;
+                --remaining;
+                std::cerr << "Shard " << i << " of " << count << " done, " << remaining << " left" << std::endl;
+            }
+        }
+
+        if (remaining == 0) {
+            uint32_t split_mode = 0;
+            if (!MergeFrameStates(paths, merged, &split_mode)) {
+                return false;
+            }
+            if (split_mode != static_cast<uint32_t>(mode)) {
+                std::cerr << "The shards in " << dir << " are not split by " << ShardModeName(mode) << std::endl;
+                return false;
+            }
+            return true;
+        }
+
+        std::chrono::duration<double> waited = std::chrono::steady_clock::now() - begin;
+        if (timeout_s >= 0 && waited.count() > timeout_s) {
+            std::cerr << "Timed out waiting for " << remaining << " shards in " << dir << std::endl;
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+}
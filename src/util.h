@@ -52,6 +52,11 @@ inline Color ACESToneMapping(Color color, XFloat adapted_lum=1.0f) {
     return (color * (A * color + B)) / (color * (C * color + D) + E);
 }
 
+// Rec. 709 luminance of a linear color
+inline XFloat Luminance(const Color& color) {
+    return 0.2126 * color.r + 0.7152 * color.g + 0.0722 * color.b;
+}
+
 inline void CanoicalColor(Color& color) {
     // Replace NaN components with zero. See explanation in Ray Tracing: The Rest of Your Life.
     if (color.r != color.r) color.r = 0.0f;